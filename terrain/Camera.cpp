@@ -36,6 +36,24 @@ glm::mat4 CCamera::getProjectionMatrix()
   return glm::perspective(glm::radians(FOV), Ratio, zNear, zFar);
 }
 
+// Gribb/Hartmann: the planes are sums and differences of the rows of projection * view.
+std::array<glm::vec4, 6> CCamera::getFrustumPlanes()
+{
+  glm::mat4 m = getProjectionMatrix() * getViewMatrix();
+  glm::vec4 row[4];
+  for (int i = 0; i < 4; i++)
+    row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+  std::array<glm::vec4, 6> planes = {
+    row[3] + row[0], row[3] - row[0],
+    row[3] + row[1], row[3] - row[1],
+    row[3] + row[2], row[3] - row[2]
+  };
+  for (auto& plane : planes)
+    plane /= glm::length(glm::vec3(plane));
+  return planes;
+}
+
 glm::vec3 CCamera::getPosition()
 {
   return transform.position;
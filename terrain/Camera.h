@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <glm/glm.hpp>
 
 struct Transform
@@ -59,6 +60,9 @@ public:
   // Returns the view matrix calculated using Eular Angles and the LookAt Matrix
   glm::mat4 getViewMatrix();
   glm::mat4 getProjectionMatrix();
+  // Left, right, bottom, top, near and far planes (a, b, c, d) of the view frustum in world space, normalized and facing
+  // inwards: a point p is inside when dot((a, b, c), p) + d >= 0 for all six.
+  std::array<glm::vec4, 6> getFrustumPlanes();
 
   glm::vec3 getPosition();
   glm::vec3 getRotation();
@@ -0,0 +1,198 @@
+#pragma once
+// Cube-to-sphere mapping shared by the renderer and the headless LOD code.
+// Nothing in here depends on a GL context.
+
+#include <cassert>
+#include <glm/glm.hpp>
+
+enum class Face
+{
+	right, //px
+	top, //py
+	back, //pz
+	left, //nx
+	botoom, //ny
+	front  //nz
+};
+
+struct Quad
+{
+	glm::vec3 p1, p2, p3, p4;
+	glm::vec3 color;
+	Quad(glm::vec3 p1, glm::vec3 p2, glm::vec3 p3, glm::vec3 p4, glm::vec3 color) : p1(p1), p2(p2), p3(p3), p4(p4), color(color) {}
+};
+
+inline glm::vec3 get_offset(Face f, glm::vec2 of, float size)
+{
+	glm::vec3 o{ 0,0,0 };
+	float& x = of.x;
+	float& y = of.y;
+	switch (f)
+	{
+	case Face::back:
+		o = { -x, y, -size };
+		break;
+	case Face::right:
+		o = { size, y, -x };
+		break;
+	case Face::left:
+		o = { -size, y, x };
+		break;
+	case Face::top:
+		o = { x, size, y };
+		break;
+	case Face::botoom:
+		o = { -x, -size, -y };
+		break;
+	case Face::front:
+		o = { x, y, size };
+		break;
+	default:
+		assert(0);
+		break;
+	}
+	return o;
+}
+
+inline Quad get_cube_face(Face f, float size, glm::vec2 origin)
+{
+	switch (f)
+	{
+		// White side - BACK
+	case Face::back:
+		return Quad({
+		glm::vec3(size, -size, 0),
+		glm::vec3(size, size, 0),
+		glm::vec3(-size, size, 0),
+		glm::vec3(-size, -size, 0),
+		glm::vec3(   1.0,  1.0, 1.0 )
+			});
+
+		// Purple side - RIGHT
+	case Face::right:
+		return Quad({
+			glm::vec3(0, -size, -size),
+			glm::vec3(0, size, -size),
+			glm::vec3(0, size, size),
+			glm::vec3(0, -size, size),
+			glm::vec3(  1.0,  0.0,  1.0 )
+			});
+
+		// Green side - LEFT
+	case Face::left:
+		return Quad({
+		glm::vec3(0, -size, size),
+		glm::vec3(0, size, size),
+		glm::vec3(0, size, -size),
+		glm::vec3(0, -size, -size),
+		glm::vec3(   0.0,  1.0,  0.0 )
+			});
+
+		// Blue side - TOP
+	case Face::top:
+		return Quad({
+		glm::vec3(size, 0, size),
+		glm::vec3(size, 0, -size),
+		glm::vec3(-size, 0, -size),
+		glm::vec3(-size, 0, size),
+		glm::vec3(   0.0,  0.0,  1.0 )
+			});
+
+		// Red side - BOTTOM
+	case Face::botoom:
+		return Quad({
+		glm::vec3(size, 0, -size),
+		glm::vec3(size, 0, size),
+		glm::vec3(-size, 0, size),
+		glm::vec3(-size, 0, -size),
+		glm::vec3(   1.0,  0.0,  0.0 )
+			});
+	case Face::front:
+		return Quad({
+		 glm::vec3(size, -size, 0),      // P1 is red
+		 glm::vec3(size, size, 0),      // P2 is green
+		 glm::vec3(-size, size, 0),      // P3 is blue
+		 glm::vec3(-size, -size, 0),      // P4 is 
+		 glm::vec3(   0.0,  1.0, 1.0 )
+			});
+	default:
+		assert(0);
+		break;
+	}
+}
+
+// 0 ... 1 output range
+inline glm::vec2 world_coords_to_face_space(const float x,const float y,const float z) {
+    return (glm::vec2(x/z,y/z)+1.0f)*0.5f;
+}
+
+// 0 ... 1 output range
+inline glm::vec2 world_coords_to_face_space(const Face face_type, const float x,const float y,const float z) {
+    switch(face_type) // same as using coords_swizzle & unity_swizzle
+    {
+		case Face::right: return world_coords_to_face_space( y,  z,  glm::abs(x)); // px
+    case Face::top: return world_coords_to_face_space(-x,  z,  glm::abs(y)); // py
+    case Face::left: return world_coords_to_face_space(-y,  z,  glm::abs(x)); // nx
+    case Face::botoom: return world_coords_to_face_space( x,  z,  glm::abs(y)); // ny
+    case Face::back: return world_coords_to_face_space( y, -x,  glm::abs(z)); // pz
+    case Face::front: return world_coords_to_face_space( y,  x,  glm::abs(z)); // nz
+    default: break;
+    };
+    return glm::vec2(0.0);
+}
+
+// Signed axes of a face: get_offset(f, (u, v), size) == u * U + v * V + size * N.
+struct FaceFrame
+{
+	glm::vec3 u, v, n;
+};
+
+inline FaceFrame face_frame(Face f)
+{
+	return { get_offset(f, glm::vec2(1, 0), 0), get_offset(f, glm::vec2(0, 1), 0), get_offset(f, glm::vec2(0, 0), 1) };
+}
+
+// Corners of the face-space node (ox, oy, size) of face f, pushed out onto
+// the sphere of the given radius. The cube has the same half extent as the
+// sphere.
+inline Quad project_to_sphere(Face f, double ox, double oy, double size, float radius)
+{
+	auto q = get_cube_face(f, 0.5 * size, glm::vec2(ox, oy));
+	glm::vec3 origin = get_offset(f, glm::vec2(ox, oy), radius);
+	q.p1 = glm::normalize(q.p1 += origin) * radius;
+	q.p2 = glm::normalize(q.p2 += origin) * radius;
+	q.p3 = glm::normalize(q.p3 += origin) * radius;
+	q.p4 = glm::normalize(q.p4 += origin) * radius;
+	return q;
+}
+
+// Focus point projected into the face space of face f, scaled to the
+// [-radius, radius] range the face trees are built in.
+inline glm::vec2 face_focus_point(Face f, glm::vec2 point, float radius)
+{
+	return 2 * radius * (world_coords_to_face_space(f, point.x, 2, point.y) - 0.5f);
+}
+
+// Bounding sphere of the sphere patch under the face-space node (ox, oy, size),
+// centred on the projected node centre, and the cone around center / radius
+// that holds all of its normals. A patch smaller than a hemisphere is farther
+// from its centre at a corner than anywhere else, and so is the flat quad
+// drawn for it.
+struct PatchBounds
+{
+	glm::vec3 center;
+	float radius;
+	float cone_cos; // cosine of the cone's half angle
+};
+
+inline PatchBounds patch_bounds(Face f, double ox, double oy, double size, float radius)
+{
+	auto q = project_to_sphere(f, ox, oy, size, radius);
+	glm::vec3 center = glm::normalize(get_offset(f, glm::vec2(ox, oy), radius)) * radius;
+	float r = glm::max(glm::max(glm::length(q.p1 - center), glm::length(q.p2 - center)),
+		glm::max(glm::length(q.p3 - center), glm::length(q.p4 - center)));
+	float c = glm::min(glm::min(glm::dot(q.p1, center), glm::dot(q.p2, center)),
+		glm::min(glm::dot(q.p3, center), glm::dot(q.p4, center))) / (radius * radius);
+	// Slack for the float rounding of the corners.
+	return { center, r + 1e-5f * radius, c - 1e-5f };
+}
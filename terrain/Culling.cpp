@@ -0,0 +1,66 @@
+#include "Culling.h"
+
+#include <algorithm>
+#include <cmath>
+
+void CPatchCuller::set(Face face, float radius, const Planes *frustum,
+                       const glm::vec3 *eye) {
+  m_face = face;
+  m_radius = radius;
+  m_use_frustum = frustum != nullptr;
+  if (frustum)
+    m_frustum = *frustum;
+  // Nothing is back-facing from below the surface.
+  float distance = eye ? glm::length(*eye) : 0;
+  m_use_horizon = distance > radius;
+  if (m_use_horizon) {
+    m_eye_dir = *eye / distance;
+    m_horizon_cos = radius / distance;
+  }
+}
+
+INodeCuller::Visibility CPatchCuller::classify(const QuadTree *qt) const {
+  auto bounds = patch_bounds(m_face, qt->x(), qt->y(), qt->size(), m_radius);
+  auto visibility = inside;
+  if (m_use_horizon)
+    visibility = classify_horizon(bounds);
+  if (m_use_frustum && visibility != outside)
+    visibility = std::min(visibility, classify_frustum(bounds));
+  return visibility;
+}
+
+INodeCuller::Visibility
+CPatchCuller::classify_frustum(const PatchBounds &bounds) const {
+  auto visibility = inside;
+  for (auto &plane : m_frustum) {
+    float distance = glm::dot(glm::vec3(plane), bounds.center) + plane.w;
+    if (distance < -bounds.radius)
+      return outside;
+    if (distance < bounds.radius)
+      visibility = partial;
+  }
+  return visibility;
+}
+
+// A point with normal n faces the camera iff the angle between n and the eye
+// direction is below the horizon angle acos(radius / distance). The normals
+// of the patch span the angles [phi - theta, phi + theta] to the eye
+// direction, where phi is the angle of the cone axis and theta its half
+// angle.
+INodeCuller::Visibility
+CPatchCuller::classify_horizon(const PatchBounds &bounds) const {
+  float cos_theta = bounds.cone_cos;
+  float sin_theta = std::sqrt(std::max(0.f, 1 - cos_theta * cos_theta));
+  float cos_phi = glm::dot(bounds.center, m_eye_dir) / m_radius;
+  float sin_phi = std::sqrt(std::max(0.f, 1 - cos_phi * cos_phi));
+
+  // cos(phi - theta), or 1 if the cone contains the eye direction.
+  float nearest =
+      cos_phi >= cos_theta ? 1 : cos_phi * cos_theta + sin_phi * sin_theta;
+  if (nearest < m_horizon_cos)
+    return outside;
+  // cos(phi + theta), or -1 if the cone contains the opposite direction.
+  float farthest =
+      cos_phi <= -cos_theta ? -1 : cos_phi * cos_theta - sin_phi * sin_theta;
+  return farthest > m_horizon_cos ? inside : partial;
+}
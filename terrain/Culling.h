@@ -0,0 +1,32 @@
+#pragma once
+#include "CubeSphere.h"
+#include "QuadTree.h"
+
+#include <array>
+
+// Culls the nodes of one face tree whose sphere patch lies completely
+// outside the view frustum, or faces away from the camera. On a sphere
+// without relief the back-facing points are exactly those beyond the
+// horizon, so the second test is the horizon test as well.
+class CPatchCuller : public INodeCuller {
+public:
+  using Planes = std::array<glm::vec4, 6>;
+
+  // Either test is skipped when its argument is null.
+  void set(Face face, float radius, const Planes *frustum,
+           const glm::vec3 *eye);
+
+  Visibility classify(const QuadTree *qt) const override;
+
+private:
+  Visibility classify_frustum(const PatchBounds &bounds) const;
+  Visibility classify_horizon(const PatchBounds &bounds) const;
+
+  Face m_face = Face::right;
+  float m_radius = 1;
+  bool m_use_frustum = false;
+  Planes m_frustum;
+  bool m_use_horizon = false;
+  glm::vec3 m_eye_dir{0, 0, 0}; // unit vector from the centre to the eye
+  float m_horizon_cos = 1;      // radius / eye distance
+};
@@ -0,0 +1,216 @@
+#include "LinearQuadTree.h"
+#include "CubeSphere.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+// Signed unit axes of a face, see face_frame().
+struct Axes {
+  int u[3], v[3], n[3];
+};
+
+struct FaceTables {
+  Axes axes[6];
+  int adjacent[6][4]; // the face across each edge, by Direction
+
+  FaceTables() {
+    for (int f = 0; f < 6; f++) {
+      auto frame = face_frame(static_cast<Face>(f));
+      for (int c = 0; c < 3; c++) {
+        axes[f].u[c] = static_cast<int>(frame.u[c]);
+        axes[f].v[c] = static_cast<int>(frame.v[c]);
+        axes[f].n[c] = static_cast<int>(frame.n[c]);
+      }
+    }
+    // The face across an edge is the one whose normal points the way the
+    // edge is crossed.
+    for (int f = 0; f < 6; f++) {
+      for (int d = 0; d < 4; d++) {
+        const int *axis = d < 2 ? axes[f].u : axes[f].v;
+        int sign = d % 2 ? 1 : -1;
+        for (int g = 0; g < 6; g++) {
+          bool match = true;
+          for (int c = 0; c < 3; c++)
+            match &= axes[g].n[c] == sign * axis[c];
+          if (match)
+            adjacent[f][d] = g;
+        }
+      }
+    }
+  }
+};
+
+const FaceTables &face_tables() {
+  static const FaceTables tables;
+  return tables;
+}
+
+int64_t dot(const int64_t p[3], const int axis[3]) {
+  return p[0] * axis[0] + p[1] * axis[1] + p[2] * axis[2];
+}
+} // namespace
+
+CLinearQuadTree::CLinearQuadTree() : m_slots(1 << 10) {}
+
+void CLinearQuadTree::set_geometry(const QuadTreeGeometry &geometry) {
+  m_geometry.set_geometry(geometry);
+}
+
+void CLinearQuadTree::clear() {
+  m_size = 0;
+  std::fill(std::begin(m_roots), std::end(m_roots), 0);
+  // Stamp 0 always means free, so that grow() needs no stamp of its own.
+  if (++m_stamp == 0) {
+    for (auto &slot : m_slots)
+      slot.stamp = 0;
+    m_stamp = 1;
+  }
+}
+
+void CLinearQuadTree::reserve(size_t nodes) {
+  while (2 * nodes > m_slots.size())
+    grow();
+}
+
+void CLinearQuadTree::insert_tree(const QuadTree &root) {
+  set_root(root.m_face, insert_node(root));
+}
+
+unsigned CLinearQuadTree::insert_node(const QuadTree &node) {
+  if (node.is_leaf())
+    return node.m_culled ? 3 : 1;
+  unsigned leaves = 0, culled = 0;
+  for (int i = 0; i < 4; i++) {
+    auto bits = insert_node(node.child(i));
+    leaves |= (bits & 1) << i;
+    culled |= (bits >> 1) << i;
+  }
+  insert(node.key(), leaves, culled);
+  return 0;
+}
+
+void CLinearQuadTree::set_root(int face, unsigned bits) {
+  m_roots[face] = root_present | (bits & 1 ? root_leaf : 0) |
+                  (bits & 2 ? root_culled : 0);
+}
+
+size_t CLinearQuadTree::size() const {
+  size_t roots = 0;
+  for (auto root : m_roots)
+    roots += root != 0;
+  return roots + 4 * m_size;
+}
+
+bool CLinearQuadTree::find(NodeKey key, Node *node) const {
+  bool leaf, culled;
+  if (key.level == 0) {
+    auto root = m_roots[key.face];
+    if (!root)
+      return false;
+    leaf = (root & root_leaf) != 0;
+    culled = (root & root_culled) != 0;
+  } else {
+    auto parent = find_slot(key.parent());
+    if (!parent)
+      return false;
+    int i = key.code & 3;
+    leaf = (parent->leaves >> i & 1) != 0;
+    culled = (parent->culled >> i & 1) != 0;
+  }
+  if (node)
+    *node = {key, leaf, culled};
+  return true;
+}
+
+const CLinearQuadTree::Slot *CLinearQuadTree::find_slot(NodeKey key) const {
+  size_t mask = m_slots.size() - 1;
+  for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+    auto &slot = m_slots[i];
+    if (slot.stamp != m_stamp)
+      return nullptr;
+    if (slot.key() == key)
+      return &slot;
+  }
+}
+
+NodeKey CLinearQuadTree::neighbour(NodeKey key, Direction direction) {
+  static const int dx[] = {-1, 1, 0, 0}, dy[] = {0, 0, -1, 1};
+  int64_t n = int64_t(1) << key.level;
+  int64_t x = int64_t(key.cell_x()) + dx[direction];
+  int64_t y = int64_t(key.cell_y()) + dy[direction];
+  if (x >= 0 && x < n && y >= 0 && y < n)
+    return NodeKey::from_cell(key.face, key.level, static_cast<uint32_t>(x),
+                              static_cast<uint32_t>(y));
+
+  // In units of half a cell the cube has half extent n, and the cell centre
+  // beyond the edge lies one unit past it. Folding it over the edge puts it
+  // one unit below the edge on the adjacent face.
+  auto &tables = face_tables();
+  auto &from = tables.axes[key.face];
+  int64_t a = 2 * x + 1 - n, b = 2 * y + 1 - n;
+  if (a < -n || a > n)
+    a = a < 0 ? -n : n;
+  else
+    b = b < 0 ? -n : n;
+  int64_t p[3];
+  for (int c = 0; c < 3; c++)
+    p[c] = a * from.u[c] + b * from.v[c] + (n - 1) * from.n[c];
+  int face = tables.adjacent[key.face][direction];
+  auto &to = tables.axes[face];
+  return NodeKey::from_cell(face, key.level,
+                            static_cast<uint32_t>((dot(p, to.u) + n - 1) / 2),
+                            static_cast<uint32_t>((dot(p, to.v) + n - 1) / 2));
+}
+
+bool CLinearQuadTree::neighbour_leaf(NodeKey key, Direction direction,
+                                     Node *leaf) const {
+  // The neighbour may be a larger leaf; one lookup per level up.
+  auto other = neighbour(key, direction);
+  Node node;
+  while (!find(other, &node)) {
+    if (other.level == 0)
+      return false;
+    other = other.parent();
+  }
+  if (!node.leaf)
+    return false;
+  *leaf = node;
+  return true;
+}
+
+size_t CLinearQuadTree::hash(NodeKey key) {
+  uint64_t h = key.code ^ uint64_t(key.level) << 58 ^ uint64_t(key.face) << 52;
+  // splitmix64's finalizer.
+  h = (h ^ h >> 30) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ h >> 27) * 0x94d049bb133111ebull;
+  return static_cast<size_t>(h ^ h >> 31);
+}
+
+void CLinearQuadTree::insert(NodeKey key, unsigned leaves, unsigned culled) {
+  if (2 * (m_size + 1) > m_slots.size())
+    grow();
+  size_t mask = m_slots.size() - 1;
+  size_t i = hash(key) & mask;
+  while (m_slots[i].stamp == m_stamp) {
+    assert(m_slots[i].key() != key);
+    i = (i + 1) & mask;
+  }
+  auto &slot = m_slots[i];
+  slot.code = key.code;
+  slot.stamp = m_stamp;
+  slot.face = key.face;
+  slot.level = key.level;
+  slot.leaves = static_cast<uint8_t>(leaves);
+  slot.culled = static_cast<uint8_t>(culled);
+  m_size++;
+}
+
+void CLinearQuadTree::grow() {
+  std::vector<Slot> slots(2 * m_slots.size());
+  std::swap(slots, m_slots);
+  m_size = 0;
+  for (auto &slot : slots)
+    if (slot.stamp == m_stamp)
+      insert(slot.key(), slot.leaves, slot.culled);
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "QuadTree.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The six face trees as one linear quadtree: NodeKeys in an open-addressing
+// hash table instead of linked nodes. The keys of parents, children and
+// same-level neighbours are computed rather than searched for, so each is
+// one O(1) lookup away, including across cube faces.
+//
+// The table holds one 16-byte entry per inner node, keyed by its NodeKey,
+// with the leaf and culled bits of its four children; a node is looked up
+// through its parent's entry.
+//
+// Neighbours across a face edge assume that each face tree spans its whole
+// face, i.e. that the geometry has its centre at the face centre.
+class CLinearQuadTree {
+public:
+  enum Direction { west, east, south, north }; // -x, +x, -y, +y
+
+  struct Node {
+    NodeKey key;
+    bool leaf;
+    bool culled; // see QuadTree::m_culled
+  };
+
+  CLinearQuadTree();
+
+  // Root geometry of all six trees; also read by the criteria and cullers
+  // through the nodes handed to them.
+  void set_geometry(const QuadTreeGeometry &geometry);
+  const QuadTreeGeometry &geometry() const { return m_geometry.geometry(); }
+
+  // Forgets all nodes in O(1), keeping the table's capacity.
+  void clear();
+  // Makes room for this many inner nodes.
+  void reserve(size_t nodes);
+
+  // Adds the tree QuadTree::split() would build for the root of face.
+  template <typename Criterion>
+  void split(int face, const Criterion &criterion,
+             const INodeCuller *culler = nullptr) {
+    QuadTree root(face, &m_geometry);
+    set_root(face, split_node(root, criterion, culler));
+  }
+  // Adds the nodes of an existing pointer tree.
+  void insert_tree(const QuadTree &root);
+
+  // Looks key up and, if it is in the tree, copies its node to *node.
+  bool find(NodeKey key, Node *node = nullptr) const;
+
+  // The key of the node of the same level next to key, on the adjacent face
+  // if key lies on a face edge. Whether that node exists is up to the tree.
+  static NodeKey neighbour(NodeKey key, Direction direction);
+  // Finds the leaf that shares the edge of key in direction if it is at
+  // key's level or above. Fails if the neighbour is subdivided further.
+  bool neighbour_leaf(NodeKey key, Direction direction, Node *leaf) const;
+
+  // Number of nodes, leaves included.
+  size_t size() const;
+  size_t capacity() const { return m_slots.size(); }
+
+  template <typename Fn> void for_each_leaf(Fn fn) const {
+    for (int face = 0; face < 6; face++)
+      if (m_roots[face] & root_leaf)
+        fn(Node{NodeKey{0, static_cast<uint8_t>(face), 0}, true,
+                (m_roots[face] & root_culled) != 0});
+    for (auto &slot : m_slots) {
+      if (slot.stamp != m_stamp)
+        continue;
+      for (int i = 0; i < 4; i++)
+        if (slot.leaves >> i & 1)
+          fn(Node{slot.key().child(i), true, (slot.culled >> i & 1) != 0});
+    }
+  }
+
+private:
+  struct Slot {
+    uint64_t code;
+    uint32_t stamp; // the slot is in use if this equals m_stamp
+    uint8_t face, level;
+    uint8_t leaves, culled; // bit i for child i
+
+    NodeKey key() const { return {code, face, level}; }
+  };
+
+  enum : uint8_t { root_present = 1, root_leaf = 2, root_culled = 4 };
+
+  // Returns the leaf and culled bits of node.
+  template <typename Criterion>
+  unsigned split_node(QuadTree &node, const Criterion &criterion,
+                      const INodeCuller *culler) {
+    auto visibility = culler ? culler->classify(&node) : INodeCuller::inside;
+    if (visibility == INodeCuller::outside)
+      return 3;
+    if (!criterion.need_split(&node))
+      return 1;
+    culler = INodeCuller::descend(culler, visibility);
+    unsigned leaves = 0, culled = 0;
+    QuadTree child;
+    for (int i = 0; i < 4; i++) {
+      node.make_child(i, child);
+      auto bits = split_node(child, criterion, culler);
+      leaves |= (bits & 1) << i;
+      culled |= (bits >> 1) << i;
+    }
+    insert(node.key(), leaves, culled);
+    return 0;
+  }
+  unsigned insert_node(const QuadTree &node);
+  void set_root(int face, unsigned bits);
+
+  static size_t hash(NodeKey key);
+  const Slot *find_slot(NodeKey key) const;
+  // Adds an inner node that is not in the table yet.
+  void insert(NodeKey key, unsigned leaves, unsigned culled);
+  void grow();
+
+  std::vector<Slot> m_slots;
+  size_t m_size = 0; // inner nodes below the roots
+  uint32_t m_stamp = 1;
+  uint8_t m_roots[6] = {};
+  // Never allocates; it only hands the geometry to the nodes built for the
+  // criteria and cullers.
+  QuadTreePool m_geometry;
+};
@@ -0,0 +1,120 @@
+#include "LodPipeline.h"
+#include "Profiler.h"
+
+#include <chrono>
+
+void build_planet_mesh(CPlanet &planet, CMeshBuilder &builder,
+                       size_t tiles_per_frame) {
+  MeshEmitter emitter(&builder);
+  if (builder.jobs) {
+    TRACE_SCOPE("collect_tiles", -1);
+    builder.jobs->collect(*builder.cache, tiles_per_frame);
+  }
+  builder.begin(planet.radius());
+  for (int i = 0; i < 6; i++) {
+    TRACE_SCOPE("visit_face", i);
+    auto face = static_cast<Face>(i);
+    builder.set_face(face);
+    builder.set_focus(face, planet.focus_point(face));
+    planet.visit(face, emitter);
+  }
+  {
+    TRACE_SCOPE("project", -1);
+    builder.end();
+  }
+  if (builder.jobs) {
+    TRACE_SCOPE("schedule_tiles", -1);
+    builder.jobs->schedule(builder.requests());
+  }
+}
+
+LodReport report_lod(const CPlanet &planet, CTileCache &cache,
+                     CTileJobs &jobs) {
+  LodReport report;
+  report.planet = planet.stats();
+  report.tiles = cache.stats();
+  report.tile_count = cache.size();
+  report.tile_bytes = cache.bytes();
+  report.jobs = jobs.stats();
+  cache.reset_stats();
+  jobs.reset_stats();
+  return report;
+}
+
+CLodPipeline::CLodPipeline(CPlanet &planet, CTileCache &cache, CTileJobs &jobs)
+    : m_planet(planet), m_cache(cache), m_jobs(jobs) {}
+
+CLodPipeline::~CLodPipeline() { stop(); }
+
+void CLodPipeline::start() {
+  if (running())
+    return;
+  // Anything left from the last run is stale.
+  m_input.update();
+  m_output.update();
+  m_has_output = false;
+  m_stop = false;
+  m_thread = std::thread([this] { run(); });
+}
+
+void CLodPipeline::stop() {
+  if (!running())
+    return;
+  {
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_one();
+  m_thread.join();
+}
+
+void CLodPipeline::submit() {
+  m_input.publish();
+  {
+    // Orders the publish against a LOD thread that is about to fall asleep,
+    // so the wake-up cannot get lost.
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+  }
+  m_wake.notify_one();
+}
+
+const LodOutput *CLodPipeline::output() {
+  if (m_output.update())
+    m_has_output = true;
+  return m_has_output ? &m_output.front() : nullptr;
+}
+
+void CLodPipeline::run() {
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> lock(m_sleep_mutex);
+      m_wake.wait(lock, [this] { return m_stop || m_input.pending(); });
+      if (m_stop)
+        return;
+    }
+    m_input.update();
+    build(m_input.front(), m_output.back());
+    m_output.publish();
+  }
+}
+
+void CLodPipeline::build(const LodInput &input, LodOutput &output) {
+  auto start = std::chrono::steady_clock::now();
+  m_planet.update(input.settings);
+  auto &builder = output.builder;
+  builder.simd_path = input.simd_path;
+  builder.cache = input.tile_cache ? &m_cache : nullptr;
+  builder.jobs = input.tile_cache && input.async_tiles ? &m_jobs : nullptr;
+  if (builder.cache)
+    m_cache.set_budget(input.tile_budget);
+  {
+    // A stage of its own: it overlaps the render thread's stages.
+    PROFILE_SCOPE("lod_emit");
+    build_planet_mesh(m_planet, builder, input.tiles_per_frame);
+  }
+  output.frame = input.frame;
+  output.report = report_lod(m_planet, m_cache, m_jobs);
+  output.report.lod_ms = std::chrono::duration<double, std::milli>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+}
@@ -0,0 +1,124 @@
+#pragma once
+#include "MeshBuilder.h"
+#include "Planet.h"
+#include "TileCache.h"
+#include "TileJobs.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+// Emits the leaves of all six faces into builder the way the batched renderer
+// draws them. If the builder has tile jobs, up to tiles_per_frame finished
+// tiles are collected first and the missing ones are scheduled afterwards.
+void build_planet_mesh(CPlanet &planet, CMeshBuilder &builder,
+                       size_t tiles_per_frame);
+
+// Hands the latest value from one producer thread to one consumer thread.
+// The producer fills back() and publish()es it; the consumer's update() makes
+// the most recently published value its front(). Neither side ever waits for
+// the other, and values published in between are skipped.
+template <typename T> class TripleBuffer {
+public:
+  T &back() { return m_slots[m_back]; }
+  void publish() {
+    m_back = m_spare.exchange(m_back | fresh, std::memory_order_acq_rel) &
+             index_mask;
+  }
+
+  // Whether a value was published since the last update().
+  bool pending() const {
+    return (m_spare.load(std::memory_order_acquire) & fresh) != 0;
+  }
+  bool update() {
+    if (!pending())
+      return false;
+    m_front =
+        m_spare.exchange(m_front, std::memory_order_acq_rel) & index_mask;
+    return true;
+  }
+  T &front() { return m_slots[m_front]; }
+
+private:
+  static constexpr unsigned index_mask = 3, fresh = 4;
+
+  T m_slots[3];
+  unsigned m_back = 0, m_front = 1; // owned by either side
+  std::atomic<unsigned> m_spare{2}; // the third slot, with the fresh bit
+};
+
+// Everything a LOD frame is computed from.
+struct LodInput {
+  LodSettings settings;
+  uint64_t frame = 0; // the render frame that submitted it
+  SimdPath simd_path = best_simd_path();
+  bool tile_cache = false;
+  size_t tile_budget = 16 << 20;
+  bool async_tiles = false;
+  size_t tiles_per_frame = 2048;
+};
+
+// What a LOD frame reports besides its meshes.
+struct LodReport {
+  CPlanet::Stats planet;
+  CTileCache::Stats tiles;
+  size_t tile_count = 0;
+  size_t tile_bytes = 0;
+  CTileJobs::Stats jobs;
+  double lod_ms = 0; // update() and mesh building
+};
+
+// Takes the current state of the LOD stage and resets the tile counters.
+LodReport report_lod(const CPlanet &planet, CTileCache &cache,
+                     CTileJobs &jobs);
+
+// A finished LOD frame.
+struct LodOutput {
+  CMeshBuilder builder;
+  uint64_t frame = 0; // LodInput::frame
+  LodReport report;
+};
+
+// Two-stage LOD pipeline. A LOD thread refines the planet from the most
+// recent input and builds the meshes into a back buffer, while the render
+// thread draws the last finished one; both hand over through TripleBuffers.
+// While the pipeline runs, the planet, the tile cache and the tile jobs
+// belong to the LOD thread, and their state is read from LodOutput::report.
+class CLodPipeline {
+public:
+  CLodPipeline(CPlanet &planet, CTileCache &cache, CTileJobs &jobs);
+  ~CLodPipeline();
+  CLodPipeline(const CLodPipeline &) = delete;
+  CLodPipeline &operator=(const CLodPipeline &) = delete;
+
+  void start();
+  // Returns once the LOD frame in progress, if any, is finished.
+  void stop();
+  bool running() const { return m_thread.joinable(); }
+
+  // Render thread: fill input(), then submit() it.
+  LodInput &input() { return m_input.back(); }
+  void submit();
+  // The most recent finished frame, or nullptr if there is none since
+  // start(). Valid until the next call.
+  const LodOutput *output();
+
+private:
+  void run();
+  void build(const LodInput &input, LodOutput &output);
+
+  CPlanet &m_planet;
+  CTileCache &m_cache;
+  CTileJobs &m_jobs;
+  TripleBuffer<LodInput> m_input;
+  TripleBuffer<LodOutput> m_output;
+  bool m_has_output = false;
+  // Only puts an idle LOD thread to sleep; the handoff does not lock.
+  std::mutex m_sleep_mutex;
+  std::condition_variable m_wake;
+  bool m_stop = false;
+  std::thread m_thread;
+};
@@ -0,0 +1,172 @@
+#include "MeshBuilder.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+// Whether b is a or a descendant of it.
+bool covers(NodeKey a, NodeKey b) {
+  if (a.face != b.face || a.level > b.level)
+    return false;
+  int shift = 2 * (b.level - a.level);
+  return shift < 64 ? (b.code >> shift) == a.code : a.code == 0;
+}
+
+const color3 &key_color(NodeKey key) {
+  return quadtree_palette[key.level ? QuadTree::root_color + 1 + (key.code & 3)
+                                    : QuadTree::root_color];
+}
+} // namespace
+
+CMeshBuilder::CMeshBuilder() {
+  for (int i = 0; i < 6; i++) {
+    auto f = static_cast<Face>(i);
+    auto frame = face_frame(f);
+    auto q = get_cube_face(f, 1, glm::vec2(0, 0));
+    glm::vec3 corners[4] = {q.p1, q.p2, q.p3, q.p4};
+    for (int c = 0; c < 4; c++) {
+      m_corner_offsets[i][c][0] = glm::dot(corners[c], frame.u);
+      m_corner_offsets[i][c][1] = glm::dot(corners[c], frame.v);
+    }
+  }
+}
+
+void CMeshBuilder::begin(float radius) {
+  for (int i = 0; i < 6; i++) {
+    m_meshes[i].clear();
+    m_corners[i].u.clear();
+    m_corners[i].v.clear();
+    m_corners[i].offsets.clear();
+    m_pending[i].clear();
+  }
+  m_requests.clear();
+  m_has_fallback = false;
+  m_radius = radius;
+}
+
+void CMeshBuilder::draw_plane(double ox, double oy, double size,
+                              color3 color) {
+  int face = static_cast<int>(m_face);
+  auto &corners = m_corners[face];
+  auto &mesh = m_meshes[face];
+  float u[4], v[4];
+  face_corners(face, ox, oy, size, u, v);
+  corners.u.insert(corners.u.end(), u, u + 4);
+  corners.v.insert(corners.v.end(), v, v + 4);
+  // Filled in by end().
+  corners.offsets.push_back(static_cast<uint32_t>(mesh.positions.size()));
+  mesh.positions.resize(mesh.positions.size() + 4);
+  glm::vec3 rgb(color.r, color.g, color.b);
+  mesh.colors.insert(mesh.colors.end(), 4, rgb);
+}
+
+void CMeshBuilder::draw_node(const QuadTree &qt) {
+  if (!cache) {
+    draw_plane(qt.x(), qt.y(), qt.size(), qt.color());
+    return;
+  }
+  int face = static_cast<int>(m_face);
+  auto &mesh = m_meshes[face];
+  auto key = qt.key();
+  if (auto tile = cache->find(key, m_radius)) {
+    draw_tile(*tile, qt.color());
+    return;
+  }
+  if (jobs) {
+    request(qt);
+    draw_fallback(qt);
+    return;
+  }
+  m_pending[face].push_back(
+      {key, static_cast<uint32_t>(mesh.positions.size())});
+  draw_plane(qt.x(), qt.y(), qt.size(), qt.color());
+}
+
+void CMeshBuilder::face_corners(int face, double ox, double oy, double size,
+                                float *u, float *v) const {
+  double half = 0.5 * size;
+  for (int c = 0; c < 4; c++) {
+    u[c] = float(ox + half * m_corner_offsets[face][c][0]);
+    v[c] = float(oy + half * m_corner_offsets[face][c][1]);
+  }
+}
+
+void CMeshBuilder::request(const QuadTree &qt) {
+  // Distance to the focus point in units of the leaf's size, the ratio the
+  // distance criterion compares with k: the leaves with the largest error
+  // come first.
+  int face = static_cast<int>(m_face);
+  double size = qt.size();
+  auto &focus = m_focus[face];
+  double distance = std::max(std::abs(qt.x() - focus.x),
+                             std::abs(qt.y() - focus.y)) -
+                    0.5 * size;
+  CTileJobs::Request request;
+  request.key = qt.key();
+  request.radius = m_radius;
+  request.priority = float(std::max(distance, 0.0) / size);
+  face_corners(face, qt.x(), qt.y(), size, request.u, request.v);
+  m_requests.push_back(request);
+}
+
+void CMeshBuilder::draw_fallback(const QuadTree &qt) {
+  // Siblings are visited one after the other, so the ancestor drawn for the
+  // previous leaf often covers this one as well.
+  auto key = qt.key();
+  if (m_has_fallback && covers(m_fallback, key))
+    return;
+  m_has_fallback = true;
+  while (key.level > 0) {
+    key = key.parent();
+    if (auto tile = cache->touch(key, m_radius)) {
+      draw_tile(*tile, key_color(key));
+      m_fallback = key;
+      return;
+    }
+  }
+  // Not even the root is ready; it is cheap enough to project here.
+  int face = static_cast<int>(m_face);
+  m_fallback = key;
+  m_pending[face].push_back(
+      {key, static_cast<uint32_t>(m_meshes[face].positions.size())});
+  auto &root = qt.m_pool->geometry();
+  draw_plane(root.x, root.y, root.size, key_color(key));
+}
+
+void CMeshBuilder::draw_tile(const Tile &tile, const color3 &color) {
+  auto &mesh = m_meshes[static_cast<int>(m_face)];
+  mesh.positions.insert(mesh.positions.end(), tile.corners, tile.corners + 4);
+  mesh.colors.insert(mesh.colors.end(), 4,
+                     glm::vec3(color.r, color.g, color.b));
+}
+
+void CMeshBuilder::end() {
+  for (int i = 0; i < 6; i++) {
+    auto &corners = m_corners[i];
+    size_t n = corners.u.size();
+    m_x.resize(n);
+    m_y.resize(n);
+    m_z.resize(n);
+    project_face_to_sphere(static_cast<Face>(i), corners.u.data(),
+                           corners.v.data(), n, m_radius, m_x.data(),
+                           m_y.data(), m_z.data(), simd_path);
+    auto &positions = m_meshes[i].positions;
+    for (size_t j = 0; j < n; j++)
+      positions[corners.offsets[j / 4] + j % 4] =
+          glm::vec3(m_x[j], m_y[j], m_z[j]);
+    if (!cache)
+      continue;
+    for (auto &pending : m_pending[i]) {
+      Tile tile;
+      std::copy_n(&positions[pending.offset], 4, tile.corners);
+      cache->insert(pending.key, m_radius, tile);
+    }
+  }
+}
+
+size_t CMeshBuilder::vertex_count() const {
+  size_t count = 0;
+  for (auto &mesh : m_meshes)
+    count += mesh.vertex_count();
+  return count;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include "CubeSphere.h"
+#include "QuadTree.h"
+#include "SphereProjection.h"
+#include "TileCache.h"
+#include "TileJobs.h"
+
+#include <vector>
+
+// Leaf quads of one face, laid out for a single GL_QUADS array draw: four
+// consecutive positions per leaf and one color per position.
+struct FaceMesh {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> colors;
+
+  void clear() {
+    positions.clear();
+    colors.clear();
+  }
+  size_t vertex_count() const { return positions.size(); }
+};
+
+// IQuadTreeRender that collects leaves into one FaceMesh per face instead of
+// drawing them. draw_plane() only records the face-space corners; end()
+// pushes all of them onto the sphere in one project_face_to_sphere() batch
+// per face. The arrays are cleared, not freed, between frames, so once they
+// have grown to the working set a frame does no heap allocation.
+//
+// With a tile cache, draw_node() copies the corners of cached leaves straight
+// into the mesh; only the others are projected by end(), which then caches
+// them. With tile jobs as well, the others are not projected at all but
+// requested from the jobs, and the nearest cached ancestor stands in for
+// them until their tiles arrive.
+class CMeshBuilder final : public IQuadTreeRender {
+public:
+  CMeshBuilder();
+
+  // Starts a new frame: empties all faces and sets the sphere radius.
+  void begin(float radius);
+  void set_face(Face f) {
+    m_face = f;
+    m_has_fallback = false;
+  }
+  // Focus point in the space of face f; requests nearer to it come first.
+  void set_focus(Face f, glm::vec2 point) {
+    m_focus[static_cast<int>(f)] = point;
+  }
+  // Projects the corners collected since begin() into the face meshes.
+  void end();
+
+  void draw_plane(double ox, double oy, double size, color3 color) override;
+  // draw_plane() for a leaf, served from cache if one is set.
+  void draw_node(const QuadTree &qt);
+
+  const FaceMesh &mesh(Face f) const { return m_meshes[static_cast<int>(f)]; }
+  size_t vertex_count() const;
+
+  // The tiles missing since begin(), for CTileJobs::schedule().
+  const std::vector<CTileJobs::Request> &requests() const {
+    return m_requests;
+  }
+
+  SimdPath simd_path = best_simd_path();
+  CTileCache *cache = nullptr;
+  CTileJobs *jobs = nullptr; // only used with a cache
+
+private:
+  struct Corners {
+    std::vector<float> u, v;
+    std::vector<uint32_t> offsets; // first position of each leaf
+  };
+  // A leaf to cache once end() has projected it.
+  struct Pending {
+    NodeKey key;
+    uint32_t offset;
+  };
+
+  void face_corners(int face, double ox, double oy, double size, float *u,
+                    float *v) const;
+  void request(const QuadTree &qt);
+  void draw_fallback(const QuadTree &qt);
+  void draw_tile(const Tile &tile, const color3 &color);
+
+  FaceMesh m_meshes[6];
+  Corners m_corners[6];
+  std::vector<Pending> m_pending[6];
+  std::vector<CTileJobs::Request> m_requests;
+  glm::vec2 m_focus[6];
+  NodeKey m_fallback; // the last ancestor drawn in place of a leaf
+  bool m_has_fallback = false;
+  std::vector<float> m_x, m_y, m_z;
+  // Face-space offsets of the p1..p4 corners of get_cube_face(), per face.
+  float m_corner_offsets[6][4][2];
+  Face m_face = Face::right;
+  float m_radius = 1;
+};
+
+// Compile-time visitor that feeds the leaves of a face tree to a
+// CMeshBuilder without any virtual calls.
+struct MeshEmitter : TreeVisitor {
+  CMeshBuilder *builder;
+
+  explicit MeshEmitter(CMeshBuilder *builder) : builder(builder) {}
+  void OnLeaf(QuadTree *qt, bool is_last, int level) {
+    builder->draw_node(*qt);
+  }
+};
@@ -0,0 +1,276 @@
+#include "MultiViewLod.h"
+
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||             \
+    defined(_M_IX86)
+#define TERRAIN_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_SSE __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE
+#define TARGET_AVX2
+#endif
+
+namespace {
+// Words with at most this many observers left are tested one by one.
+const size_t sparse_observers = 8;
+
+size_t count(uint64_t bits) {
+  bits -= bits >> 1 & 0x5555555555555555ull;
+  bits = (bits & 0x3333333333333333ull) + (bits >> 2 & 0x3333333333333333ull);
+  bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0full;
+  return static_cast<size_t>(bits * 0x0101010101010101ull >> 56);
+}
+
+int lowest_bit(uint64_t bits) {
+#if defined(__GNUC__)
+  return __builtin_ctzll(bits);
+#else
+  unsigned long index;
+  _BitScanForward64(&index, bits);
+  return static_cast<int>(index);
+#endif
+}
+
+// The distance test of QuadTree::need_split() for the observers in active,
+// one mask word of them, at (x[i], y[i]); bit i of the result is set if
+// observer i splits the node (ox, oy, size). All paths give the same bits.
+using SplitWord = uint64_t (*)(const double *x, const double *y,
+                               uint64_t active, double ox, double oy,
+                               double size, double kl);
+
+uint64_t split_word_scalar(const double *x, const double *y, uint64_t active,
+                           double ox, double oy, double size, double kl) {
+  uint64_t bits = 0;
+  for (; active; active &= active - 1) {
+    int i = lowest_bit(active);
+    if (QuadTree::split_distance(x[i], y[i], ox, oy, size) < kl)
+      bits |= uint64_t(1) << i;
+  }
+  return bits;
+}
+
+#ifdef TERRAIN_X86
+// Both vector paths skip groups of four observers that are all inactive.
+TARGET_SSE uint64_t split_word_sse(const double *x, const double *y,
+                                   uint64_t active, double ox, double oy,
+                                   double size, double kl) {
+  const __m128d vox = _mm_set1_pd(ox), voy = _mm_set1_pd(oy);
+  const __m128d vsize = _mm_set1_pd(size), vkl = _mm_set1_pd(kl);
+  const __m128d sign = _mm_set1_pd(-0.0);
+  uint64_t bits = 0;
+  for (int i = 0; i < 64; i += 2) {
+    if (i % 4 == 0 && !(active >> i & 15)) {
+      i += 2;
+      continue;
+    }
+    __m128d dx = _mm_sub_pd(_mm_loadu_pd(x + i), vox);
+    __m128d dy = _mm_sub_pd(_mm_loadu_pd(y + i), voy);
+    __m128d mx = _mm_min_pd(_mm_andnot_pd(sign, dx),
+                            _mm_andnot_pd(sign, _mm_sub_pd(dx, vsize)));
+    __m128d my = _mm_min_pd(_mm_andnot_pd(sign, dy),
+                            _mm_andnot_pd(sign, _mm_sub_pd(dy, vsize)));
+    __m128d split = _mm_cmplt_pd(_mm_max_pd(mx, my), vkl);
+    bits |= uint64_t(_mm_movemask_pd(split)) << i;
+  }
+  return bits & active;
+}
+
+TARGET_AVX2 uint64_t split_word_avx2(const double *x, const double *y,
+                                     uint64_t active, double ox, double oy,
+                                     double size, double kl) {
+  const __m256d vox = _mm256_set1_pd(ox), voy = _mm256_set1_pd(oy);
+  const __m256d vsize = _mm256_set1_pd(size), vkl = _mm256_set1_pd(kl);
+  const __m256d sign = _mm256_set1_pd(-0.0);
+  uint64_t bits = 0;
+  for (int i = 0; i < 64; i += 4) {
+    if (!(active >> i & 15))
+      continue;
+    __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(x + i), vox);
+    __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(y + i), voy);
+    __m256d mx =
+        _mm256_min_pd(_mm256_andnot_pd(sign, dx),
+                      _mm256_andnot_pd(sign, _mm256_sub_pd(dx, vsize)));
+    __m256d my =
+        _mm256_min_pd(_mm256_andnot_pd(sign, dy),
+                      _mm256_andnot_pd(sign, _mm256_sub_pd(dy, vsize)));
+    __m256d split = _mm256_cmp_pd(_mm256_max_pd(mx, my), vkl, _CMP_LT_OQ);
+    bits |= uint64_t(_mm256_movemask_pd(split)) << i;
+  }
+  return bits & active;
+}
+#endif
+
+SplitWord split_word(SimdPath path) {
+  if (!simd_path_supported(path))
+    path = SimdPath::scalar;
+  switch (path) {
+#ifdef TERRAIN_X86
+  case SimdPath::avx2:
+    return split_word_avx2;
+  case SimdPath::sse:
+    return split_word_sse;
+#endif
+  default:
+    return split_word_scalar;
+  }
+}
+} // namespace
+
+uint64_t *CMultiViewLod::MaskArena::allocate(size_t words) {
+  if (m_used + words > m_chunk_words) {
+    m_chunk++;
+    m_used = 0;
+  }
+  if (m_chunk == m_chunks.size())
+    m_chunks.emplace_back(new uint64_t[m_chunk_words]);
+  auto mask = m_chunks[m_chunk].get() + m_used;
+  m_used += words;
+  return mask;
+}
+
+void CMultiViewLod::MaskArena::reset(size_t words) {
+  // Chunks hold at least 4096 words, and always a whole mask.
+  if (words > m_chunk_words) {
+    m_chunks.clear();
+    m_chunk_words = std::max<size_t>(words, 4096);
+  }
+  // The first allocate() moves on to chunk 0.
+  m_chunk = ~size_t(0);
+  m_used = m_chunk_words;
+}
+
+CMultiViewLod::CMultiViewLod(WorkStealingPool &workers) : m_workers(workers) {
+  for (unsigned i = 0; i < workers.size(); i++)
+    m_parts.emplace_back(new Part);
+}
+
+void CMultiViewLod::update(const LodSettings &settings,
+                           const glm::vec2 *observers, size_t count) {
+  QuadTreeGeometry geometry;
+  geometry.depth = settings.depth;
+  geometry.size = settings.size;
+  geometry.x = settings.origin.x;
+  geometry.y = settings.origin.y;
+  m_geometry.set_geometry(geometry);
+  m_observers = count;
+  m_words = (count + 63) / 64;
+  m_k = settings.k;
+  m_split_word = split_word(simd_path);
+  m_stats = Stats();
+  for (auto &part : m_parts) {
+    part->nodes.clear();
+    part->masks.reset(m_words);
+    part->split.resize((settings.depth + 1) * m_words);
+    part->observer_nodes = 0;
+  }
+  if (count == 0)
+    return;
+
+  float radius = 0.5f * settings.size;
+  for (int f = 0; f < 6; f++) {
+    auto &points = m_points[f];
+    points.x.assign(m_words * 64, 0);
+    points.y.assign(m_words * 64, 0);
+    for (size_t i = 0; i < count; i++) {
+      auto p = face_focus_point(static_cast<Face>(f), observers[i], radius);
+      points.x[i] = p.x;
+      points.y[i] = p.y;
+    }
+  }
+  m_all.assign(m_words, ~uint64_t(0));
+  if (count % 64)
+    m_all.back() = (uint64_t(1) << count % 64) - 1;
+
+  WorkStealingPool::TaskGroup group;
+  const uint64_t *all = m_all.data();
+  for (int f = 0; f < 6; f++) {
+    QuadTree root(f, &m_geometry);
+    m_workers.run(group,
+                  [this, &group, root, all] { split_task(group, root, all); });
+  }
+  m_workers.wait(group);
+
+  for (auto &part : m_parts) {
+    m_stats.nodes += part->nodes.size();
+    m_stats.observer_nodes += part->observer_nodes;
+  }
+}
+
+void CMultiViewLod::leaves(size_t observer, std::vector<NodeKey> &out) const {
+  out.clear();
+  for_each_node([&](const Node &node) {
+    if (has(node.leaves, observer))
+      out.push_back(node.key);
+  });
+  std::sort(out.begin(), out.end());
+}
+
+void CMultiViewLod::split_task(WorkStealingPool::TaskGroup &group,
+                               const QuadTree &node, const uint64_t *active) {
+  auto &part = *m_parts[m_workers.current_index()];
+  if (node.m_level >= task_levels) {
+    split_serial(part, node, active);
+    return;
+  }
+  // Read by the children's tasks after this one has returned.
+  auto split = part.masks.allocate(m_words);
+  if (!visit(part, node, active, split))
+    return;
+  QuadTree parent = node;
+  for (int i = 0; i < 4; i++) {
+    QuadTree child;
+    parent.make_child(i, child);
+    m_workers.run(group, [this, &group, child, split] {
+      split_task(group, child, split);
+    });
+  }
+}
+
+void CMultiViewLod::split_serial(Part &part, const QuadTree &node,
+                                 const uint64_t *active) {
+  auto split = &part.split[node.m_level * m_words];
+  if (!visit(part, node, active, split))
+    return;
+  QuadTree parent = node;
+  for (int i = 0; i < 4; i++) {
+    QuadTree child;
+    parent.make_child(i, child);
+    split_serial(part, child, split);
+  }
+}
+
+bool CMultiViewLod::visit(Part &part, const QuadTree &node,
+                          const uint64_t *active, uint64_t *split) {
+  auto leaves = part.masks.allocate(m_words);
+  // QuadTree::need_split() never splits the last levels.
+  bool deep = node.depth() > 3;
+  double size = node.size();
+  double ox = node.x() - 0.5 * size, oy = node.y() - 0.5 * size;
+  double kl = m_k * size;
+  auto &points = m_points[node.m_face];
+  bool any = false;
+  for (size_t w = 0; w < m_words; w++) {
+    uint64_t observers = active[w], bits = 0;
+    if (observers) {
+      size_t n = count(observers);
+      part.observer_nodes += n;
+      if (deep && n > sparse_observers)
+        bits = m_split_word(&points.x[64 * w], &points.y[64 * w], observers,
+                            ox, oy, size, kl);
+      else if (deep)
+        bits = split_word_scalar(&points.x[64 * w], &points.y[64 * w],
+                                 observers, ox, oy, size, kl);
+    }
+    split[w] = bits;
+    leaves[w] = observers & ~bits;
+    any = any || bits != 0;
+  }
+  part.nodes.push_back({node.key(), !any, leaves});
+  return any;
+}
@@ -0,0 +1,127 @@
+#pragma once
+#include "Planet.h"
+#include "QuadTree.h"
+#include "SphereProjection.h"
+#include "ThreadPool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// LOD for many observers at once, e.g. for a server that decides which
+// terrain detail each client needs. One traversal per face builds the union
+// of the trees QuadTree::split() would build for every observer's focus
+// point, and records for each node the observers that have it as a leaf.
+//
+// A node is tested only for the observers whose tree contains it, and those
+// tests run together: the distance test is vectorized over the observers of
+// a 64-bit mask word, so the coarse levels all observers share are visited
+// once rather than once per observer. Observers that are close to each other
+// should have close indices; the vector paths skip groups of four observers
+// that are all done. The nodes of the first task_levels levels are refined
+// as separate tasks on a WorkStealingPool, each participant writing into
+// storage of its own.
+//
+// Only the distance criterion is supported, without culling; mode, policy
+// and the culling fields of LodSettings are ignored.
+class CMultiViewLod {
+public:
+  struct Node {
+    NodeKey key;
+    bool leaf; // a leaf of the union tree, so of every observer that has it
+    // The observers that have this node as a leaf, one bit each, in words()
+    // 64-bit words.
+    const uint64_t *leaves;
+  };
+
+  struct Stats {
+    size_t nodes = 0;          // in the union tree
+    size_t observer_nodes = 0; // in all observers' trees together, i.e.
+                               // the nodes one split() per observer builds
+  };
+
+  explicit CMultiViewLod(WorkStealingPool &workers);
+  CMultiViewLod(const CMultiViewLod &) = delete;
+  CMultiViewLod &operator=(const CMultiViewLod &) = delete;
+
+  // Refines all six faces for count observers, whose focus points follow the
+  // convention of LodSettings::point, with the depth, size, origin and split
+  // factor of settings. The nodes stay valid until the next update().
+  void update(const LodSettings &settings, const glm::vec2 *observers,
+              size_t count);
+
+  size_t observers() const { return m_observers; }
+  // Words in each leaf mask.
+  size_t words() const { return m_words; }
+  static bool has(const uint64_t *mask, size_t observer) {
+    return (mask[observer / 64] >> observer % 64 & 1) != 0;
+  }
+
+  // Calls fn(const Node &) for every node of the union tree, in no
+  // particular order.
+  template <typename Fn> void for_each_node(Fn fn) const {
+    for (auto &part : m_parts)
+      for (auto &node : part->nodes)
+        fn(node);
+  }
+  // The leaves of one observer, sorted by NodeKey: the leaves split() builds
+  // for its focus point.
+  void leaves(size_t observer, std::vector<NodeKey> &out) const;
+
+  const Stats &stats() const { return m_stats; }
+
+  SimdPath simd_path = best_simd_path();
+  int task_levels = 3;
+
+private:
+  // Masks that stay where they are until reset(), so that tasks and nodes
+  // can point into them.
+  class MaskArena {
+  public:
+    uint64_t *allocate(size_t words);
+    // Forgets all masks; the next ones are at most words wide.
+    void reset(size_t words);
+
+  private:
+    std::vector<std::unique_ptr<uint64_t[]>> m_chunks;
+    size_t m_chunk_words = 0;
+    size_t m_chunk = 0, m_used = 0;
+  };
+
+  // What one participant of the pool writes.
+  struct Part {
+    std::vector<Node> nodes;
+    MaskArena masks;
+    std::vector<uint64_t> split; // per level, for the serial recursion
+    size_t observer_nodes = 0;
+  };
+
+  // The observers' focus points in the space of one face, padded to whole
+  // mask words with zeros.
+  struct FacePoints {
+    std::vector<double> x, y;
+  };
+
+  void split_task(WorkStealingPool::TaskGroup &group, const QuadTree &node,
+                  const uint64_t *active);
+  void split_serial(Part &part, const QuadTree &node, const uint64_t *active);
+  // Records node and computes the observers that split it into split;
+  // returns whether any do.
+  bool visit(Part &part, const QuadTree &node, const uint64_t *active,
+             uint64_t *split);
+
+  WorkStealingPool &m_workers;
+  std::vector<std::unique_ptr<Part>> m_parts;
+  QuadTreePool m_geometry; // never allocates, see CLinearQuadTree
+  FacePoints m_points[6];
+  std::vector<uint64_t> m_all; // every observer's bit
+  size_t m_observers = 0;
+  size_t m_words = 0;
+  double m_k = 1;
+  // The distance test of simd_path over one mask word of observers.
+  uint64_t (*m_split_word)(const double *x, const double *y, uint64_t active,
+                           double ox, double oy, double size,
+                           double kl) = nullptr;
+  Stats m_stats;
+};
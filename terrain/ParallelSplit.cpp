@@ -0,0 +1,65 @@
+#include "ParallelSplit.h"
+
+ParallelSplitter::ParallelSplitter(WorkStealingPool &workers)
+    : m_workers(workers) {
+  for (unsigned i = 0; i < workers.size(); i++)
+    m_pools.emplace_back(new QuadTreePool);
+}
+
+void ParallelSplitter::split(const Job *jobs, size_t count, double k) {
+  if (count == 0)
+    return;
+  for (auto &pool : m_pools)
+    pool->set_geometry(jobs[0].root->m_pool->geometry());
+  WorkStealingPool::TaskGroup group;
+  for (size_t i = 0; i < count; i++) {
+    auto job = &jobs[i];
+    m_workers.run(group, [this, &group, job, k] {
+      split_node(group, job->root, job, k, job->culler);
+    });
+  }
+  m_workers.wait(group);
+}
+
+void ParallelSplitter::split_node(WorkStealingPool::TaskGroup &group,
+                                  QuadTree *node, const Job *job, double k,
+                                  const INodeCuller *culler) {
+  DistanceCriterion distance(job->px, job->py, k);
+  // A node's pool is the one its children are allocated from.
+  node->m_pool = m_pools[m_workers.current_index()].get();
+  if (node->m_level >= task_levels) {
+    if (job->criterion)
+      node->split(*job->criterion, culler);
+    else
+      node->split(distance, culler);
+    return;
+  }
+  auto visibility = culler ? culler->classify(node) : INodeCuller::inside;
+  node->m_culled = visibility == INodeCuller::outside;
+  if (node->m_culled)
+    return;
+  culler = INodeCuller::descend(culler, visibility);
+  if (!(job->criterion ? job->criterion->need_split(node)
+                       : distance.need_split(node)))
+    return;
+  node->m_first_child = node->m_pool->allocate4();
+  for (int i = 0; i < 4; i++) {
+    auto child = &node->child(i);
+    node->make_child(i, *child);
+    m_workers.run(group, [this, &group, child, job, k, culler] {
+      split_node(group, child, job, k, culler);
+    });
+  }
+}
+
+void ParallelSplitter::reset() {
+  for (auto &pool : m_pools)
+    pool->reset();
+}
+
+size_t ParallelSplitter::size() const {
+  size_t size = 0;
+  for (auto &pool : m_pools)
+    size += pool->size();
+  return size;
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "QuadTree.h"
+#include "ThreadPool.h"
+
+// Builds several quadtrees at once on a WorkStealingPool, each with its own
+// split criterion and INodeCuller. Every root becomes a task, and so does
+// every child of a split node on the first task_levels levels; the subtrees
+// below are split serially by whichever participant picked them up. The
+// resulting trees are identical to QuadTree::split().
+//
+// Nodes are allocated from a per-participant QuadTreePool, so the build takes
+// no locks besides the ones inside the work queues. Those pools take over the
+// geometry of the first root; all roots must share it.
+class ParallelSplitter {
+public:
+  struct Job {
+    QuadTree *root;
+    double px, py;
+    const INodeCuller *culler = nullptr;
+    // Replaces the distance test against (px, py) if set.
+    const ISplitCriterion *criterion = nullptr;
+  };
+
+  explicit ParallelSplitter(WorkStealingPool &workers);
+
+  // Splits all jobs' roots and waits for the build to finish. The trees stay
+  // valid until the next reset().
+  void split(const Job *jobs, size_t count, double k);
+  void reset();
+
+  WorkStealingPool &workers() { return m_workers; }
+  // Nodes allocated by all participants since the last reset().
+  size_t size() const;
+
+  int task_levels = 3;
+
+private:
+  void split_node(WorkStealingPool::TaskGroup &group, QuadTree *node,
+                  const Job *job, double k, const INodeCuller *culler);
+
+  WorkStealingPool &m_workers;
+  std::vector<std::unique_ptr<QuadTreePool>> m_pools;
+};
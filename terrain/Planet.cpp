@@ -0,0 +1,185 @@
+#include "Planet.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+void count_visible(const QuadTree &qt, CPlanet::Stats &stats) {
+  if (qt.m_culled)
+    stats.culled++;
+  else if (qt.is_leaf())
+    stats.visible++;
+  else
+    for (int i = 0; i < 4; i++)
+      count_visible(qt.child(i), stats);
+}
+
+struct KeyCollector : TreeVisitor {
+  std::vector<NodeKey> *keys;
+
+  explicit KeyCollector(std::vector<NodeKey> *keys) : keys(keys) {}
+  void OnLeaf(QuadTree *qt, bool is_last, int level) {
+    keys->push_back(qt->key());
+  }
+};
+
+QuadTreeGeometry geometry(const LodSettings &settings) {
+  QuadTreeGeometry geometry;
+  geometry.depth = settings.depth;
+  geometry.size = settings.size;
+  geometry.x = settings.origin.x;
+  geometry.y = settings.origin.y;
+  return geometry;
+}
+} // namespace
+
+CPlanet::CPlanet(WorkStealingPool &workers) : m_splitter(workers) {}
+
+void CPlanet::rebuild_persistent() {
+  m_persistent.clear();
+  m_persistent_pool.reset();
+  m_persistent_pool.set_geometry(geometry(m_settings));
+  for (int i = 0; i < 6; i++)
+    m_persistent.emplace_back(i, &m_persistent_pool);
+  m_hysteresis.born.clear();
+  m_persistent_depth = m_settings.depth;
+  m_persistent_size = m_settings.size;
+}
+
+void CPlanet::update_deltas() {
+  TRACE_SCOPE("leaf_deltas", -1);
+  std::swap(m_leaves, m_previous_leaves);
+  m_leaves.clear();
+  KeyCollector collector(&m_leaves);
+  for (int i = 0; i < 6; i++)
+    visit(static_cast<Face>(i), collector);
+  assert(std::is_sorted(m_leaves.begin(), m_leaves.end()));
+  // Both sets are sorted, so each difference is a single merge pass.
+  m_added.clear();
+  m_removed.clear();
+  std::set_difference(m_leaves.begin(), m_leaves.end(),
+                      m_previous_leaves.begin(), m_previous_leaves.end(),
+                      std::back_inserter(m_added));
+  std::set_difference(m_previous_leaves.begin(), m_previous_leaves.end(),
+                      m_leaves.begin(), m_leaves.end(),
+                      std::back_inserter(m_removed));
+  m_stats.added = m_added.size();
+  m_stats.removed = m_removed.size();
+}
+
+void CPlanet::update(const LodSettings &settings) {
+  PROFILE_SCOPE("split");
+  m_settings = settings;
+  m_stats = Stats();
+  if (settings.mode == LodMode::incremental &&
+      (m_persistent_depth != settings.depth ||
+       m_persistent_size != settings.size))
+    rebuild_persistent();
+  if (settings.mode == LodMode::incremental) {
+    m_hysteresis.band = settings.merge_band;
+    m_hysteresis.min_lifetime = static_cast<uint32_t>(settings.min_lifetime);
+    m_hysteresis.update++;
+    m_hysteresis.flips = 0;
+  }
+
+  m_pool.reset();
+  m_pool.set_geometry(geometry(settings));
+  m_splitter.reset();
+  ParallelSplitter::Job jobs[6];
+  QuadTree *roots[6];
+  const ISplitCriterion *criteria[6];
+  const INodeCuller *cullers[6] = {};
+  bool cull = settings.frustum_cull || settings.horizon_cull;
+  for (int i = 0; i < 6; i++) {
+    auto face = static_cast<Face>(i);
+    if (cull) {
+      m_cullers[i].set(face, radius(),
+                       settings.frustum_cull ? &settings.frustum : nullptr,
+                       settings.horizon_cull ? &settings.eye : nullptr);
+      cullers[i] = &m_cullers[i];
+    }
+    const ISplitCriterion *criterion = nullptr;
+    if (settings.policy == SplitPolicy::screen_space) {
+      m_criteria[i].set(face, radius(), settings.eye, settings.fov,
+                        settings.viewport_height, settings.pixel_error);
+      criterion = &m_criteria[i];
+    }
+    auto p = face_focus_point(face, settings.point, radius());
+    m_points[i] = p;
+    if (settings.mode == LodMode::incremental) {
+      TRACE_SCOPE("refine_face", i);
+      m_stats.changed +=
+          criterion
+              ? m_persistent[i].update(*criterion, m_hysteresis, cullers[i])
+              : m_persistent[i].update(p.x, p.y, settings.k, m_hysteresis,
+                                       cullers[i]);
+      m_faces[i] = m_persistent[i].root();
+      continue;
+    }
+    m_faces[i] = QuadTree(i, &m_pool);
+    if (settings.mode == LodMode::rebuild) {
+      TRACE_SCOPE("split_face", i);
+      if (criterion)
+        m_faces[i].split(*criterion, cullers[i]);
+      else
+        m_faces[i].split(p.x, p.y, settings.k, cullers[i]);
+    }
+    if (settings.mode == LodMode::breadth_first) {
+      TRACE_SCOPE("split_face", i);
+      if (criterion)
+        m_faces[i].split_breadth_first(*criterion, cullers[i], m_levels);
+      else
+        m_faces[i].split_breadth_first(
+            DistanceCriterion(p.x, p.y, settings.k), cullers[i], m_levels);
+    }
+    jobs[i] = {&m_faces[i], p.x, p.y, cullers[i], criterion};
+    m_distances[i] = DistanceCriterion(p.x, p.y, settings.k);
+    roots[i] = &m_faces[i];
+    criteria[i] = criterion ? criterion : &m_distances[i];
+  }
+  if (settings.mode == LodMode::budgeted) {
+    TRACE_SCOPE("split_budgeted", -1);
+    auto split = split_budgeted(roots, criteria, cullers, 6,
+                                settings.node_budget, m_budget);
+    m_stats.denied = split.denied;
+  }
+  if (settings.mode == LodMode::parallel) {
+    TRACE_SCOPE("split_parallel", -1);
+    m_splitter.split(jobs, 6, settings.k);
+  }
+  if (settings.mode == LodMode::incremental)
+    m_stats.flips = m_hysteresis.flips;
+  if (settings.leaf_deltas) {
+    update_deltas();
+  } else {
+    m_leaves.clear();
+    m_added.clear();
+    m_removed.clear();
+  }
+  if (settings.mode == LodMode::implicit)
+    return;
+  if (cull)
+    for (auto &face : m_faces)
+      count_visible(face, m_stats);
+
+  switch (settings.mode) {
+  case LodMode::rebuild:
+  case LodMode::breadth_first:
+  case LodMode::budgeted:
+    m_stats.nodes = 6 + m_pool.size();
+    break;
+  case LodMode::incremental:
+    m_stats.nodes = 6 + m_persistent_pool.live();
+    break;
+  case LodMode::parallel:
+    m_stats.nodes = 6 + m_splitter.size();
+    break;
+  case LodMode::implicit:
+    break;
+  }
+  // Every inner node has four children, culled or not.
+  m_stats.leaves = (3 * m_stats.nodes + 6) / 4;
+  TRACE_COUNTER("nodes", m_stats.nodes);
+  TRACE_COUNTER("leaves", m_stats.leaves);
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include "CubeSphere.h"
+#include "Culling.h"
+#include "ParallelSplit.h"
+#include "QuadTree.h"
+#include "ScreenSpaceError.h"
+#include "ThreadPool.h"
+
+// implicit builds no trees at all; visit() enumerates the leaves directly.
+// budgeted rebuilds with at most LodSettings::node_budget nodes.
+enum class LodMode {
+  rebuild,
+  incremental,
+  parallel,
+  breadth_first,
+  implicit,
+  budgeted
+};
+enum class SplitPolicy { distance, screen_space };
+
+// Everything the LOD pass of one frame depends on.
+struct LodSettings {
+  int depth = 16;
+  float size = 4.f;        // edge length of a face in face space
+  glm::vec2 origin{0, 0};  // centre of a face in face space
+  float k = 1.5f;          // split factor
+  glm::vec2 point{0, 0};   // focus point, see face_focus_point()
+  LodMode mode = LodMode::incremental;
+  SplitPolicy policy = SplitPolicy::distance;
+  float pixel_error = 2;      // screen_space: split above this many pixels
+  float fov = 45;             // screen_space: vertical, in degrees
+  int viewport_height = 720;  // screen_space
+  bool frustum_cull = false;
+  CPatchCuller::Planes frustum; // see CCamera::getFrustumPlanes()
+  bool horizon_cull = false;
+  glm::vec3 eye{0, 0, 0}; // camera position, relative to the planet centre;
+                          // used by horizon_cull and screen_space
+  bool leaf_deltas = false; // track the leaves added and removed, see added()
+  size_t node_budget = 1 << 18; // budgeted: nodes in all six trees, roots
+                                // included
+  float merge_band = 0;  // incremental: see RefineHysteresis::band
+  int min_lifetime = 0;  // incremental: in updates, see RefineHysteresis
+};
+
+// The six face quadtrees of the cube-sphere. GL-free, so it can be driven by
+// the viewer as well as by headless tools.
+class CPlanet {
+public:
+  struct Stats {
+    size_t nodes = 0;   // nodes in all six trees, 0 in implicit mode
+    size_t leaves = 0;  // leaves in all six trees, 0 in implicit mode
+    size_t changed = 0; // nodes created or released by an incremental update
+    size_t visible = 0; // leaves left after culling
+    size_t culled = 0;  // roots of culled subtrees
+    size_t added = 0;   // leaves new since the previous update, if tracked
+    size_t removed = 0; // leaves gone since the previous update, if tracked
+    size_t denied = 0;  // budgeted: leaves left unsplit for lack of budget;
+                        // the trees wanted at least 4 * denied more nodes
+    size_t flips = 0;   // nodes split or merged by an incremental update
+  };
+
+  explicit CPlanet(WorkStealingPool &workers);
+
+  void update(const LodSettings &settings);
+
+  QuadTree &face(Face f) { return m_faces[static_cast<int>(f)]; }
+  // face(f).visit(visitor), or the same leaves enumerated on the fly in
+  // implicit mode.
+  template <typename Visitor> void visit(Face f, Visitor &visitor);
+  float radius() const { return 0.5f * m_settings.size; }
+  // The focus point in the space of face f, as of the last update().
+  glm::vec2 focus_point(Face f) const { return m_points[static_cast<int>(f)]; }
+  const LodSettings &settings() const { return m_settings; }
+  const Stats &stats() const { return m_stats; }
+  // With LodSettings::leaf_deltas, the visible leaves the last update() added
+  // and removed, sorted by NodeKey. The first tracked update adds them all.
+  const std::vector<NodeKey> &added() const { return m_added; }
+  const std::vector<NodeKey> &removed() const { return m_removed; }
+  WorkStealingPool &workers() { return m_splitter.workers(); }
+
+private:
+  void rebuild_persistent();
+  void update_deltas();
+
+  LodSettings m_settings;
+  Stats m_stats;
+  QuadTree m_faces[6];
+
+  QuadTreePool m_pool;
+  LevelOrderScratch m_levels;
+  BudgetScratch m_budget;
+  DistanceCriterion m_distances[6]; // budgeted, with SplitPolicy::distance
+  QuadTreePool m_persistent_pool;
+  std::vector<PersistentQuadTree> m_persistent;
+  RefineHysteresis m_hysteresis;
+  int m_persistent_depth = -1;
+  float m_persistent_size = 0;
+  ParallelSplitter m_splitter;
+  CPatchCuller m_cullers[6];
+  CScreenSpaceError m_criteria[6];
+  glm::vec2 m_points[6]; // the focus point in each face's space
+  // The visible leaves of the last two tracked updates, sorted by NodeKey.
+  std::vector<NodeKey> m_leaves, m_previous_leaves;
+  std::vector<NodeKey> m_added, m_removed;
+};
+
+template <typename Visitor> void CPlanet::visit(Face f, Visitor &visitor) {
+  int i = static_cast<int>(f);
+  if (m_settings.mode != LodMode::implicit) {
+    m_faces[i].visit(visitor);
+    return;
+  }
+  const INodeCuller *culler = nullptr;
+  if (m_settings.frustum_cull || m_settings.horizon_cull)
+    culler = &m_cullers[i];
+  if (m_settings.policy == SplitPolicy::screen_space)
+    m_faces[i].visit_implicit(m_criteria[i], visitor, culler);
+  else
+    m_faces[i].visit_implicit(
+        DistanceCriterion(m_points[i].x, m_points[i].y, m_settings.k),
+        visitor, culler);
+}
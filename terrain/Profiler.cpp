@@ -0,0 +1,84 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <cstring>
+
+constexpr int CProfiler::max_stages;
+constexpr int CProfiler::history;
+
+CProfiler &CProfiler::instance() {
+  static CProfiler profiler;
+  return profiler;
+}
+
+CProfiler::CProfiler() : m_frame_start(clock::now()) {
+  for (auto &ns : m_current)
+    ns = 0;
+}
+
+int CProfiler::stage(const char *name) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  for (size_t i = 0; i < m_names.size(); i++)
+    if (m_names[i] == name)
+      return static_cast<int>(i);
+  // Further stages share the last slot.
+  if (m_names.size() == max_stages)
+    return max_stages - 1;
+  m_names.push_back(name);
+  return static_cast<int>(m_names.size() - 1);
+}
+
+void CProfiler::end_frame() {
+  auto now = clock::now();
+  auto &row = m_ms[m_next];
+  for (int i = 0; i < max_stages; i++)
+    row[i] = 1e-6f * m_current[i].exchange(0, std::memory_order_relaxed);
+  row[max_stages] =
+      std::chrono::duration<float, std::milli>(now - m_frame_start).count();
+  m_frame_start = now;
+  m_next = (m_next + 1) % history;
+  m_frames = std::min(m_frames + 1, history);
+}
+
+int CProfiler::stage_count() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return static_cast<int>(m_names.size());
+}
+
+std::string CProfiler::stage_name(int stage) const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_names[stage];
+}
+
+float CProfiler::stage_ms(int n, int stage) const {
+  return m_ms[slot(n)][stage];
+}
+
+float CProfiler::frame_ms(int n) const { return m_ms[slot(n)][max_stages]; }
+
+CProfiler::StageStats CProfiler::stats(int stage) const {
+  return stats_of(&m_ms[0][stage], max_stages + 1);
+}
+
+CProfiler::StageStats CProfiler::frame_stats() const {
+  return stats_of(&m_ms[0][max_stages], max_stages + 1);
+}
+
+CProfiler::StageStats CProfiler::stats_of(const float *samples,
+                                          int stride) const {
+  StageStats stats;
+  if (m_frames == 0)
+    return stats;
+  // Ring order does not matter here, only which slots are filled.
+  float sorted[history];
+  for (int n = 0; n < m_frames; n++)
+    sorted[n] = samples[slot(n) * stride];
+  std::sort(sorted, sorted + m_frames);
+  stats.min = sorted[0];
+  float sum = 0;
+  for (int n = 0; n < m_frames; n++)
+    sum += sorted[n];
+  stats.avg = sum / m_frames;
+  stats.p99 = sorted[std::min(m_frames - 1, m_frames * 99 / 100)];
+  return stats;
+}
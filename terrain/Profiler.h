@@ -0,0 +1,124 @@
+#pragma once
+#include "TraceRecorder.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Compile-time switch: with TERRAIN_PROFILER 0 the PROFILE_* and TRACE_*
+// macros expand to nothing. Defaults to on in debug builds only; the
+// TERRAIN_PROFILER CMake option keeps it in release builds too.
+#ifndef TERRAIN_PROFILER
+#ifdef NDEBUG
+#define TERRAIN_PROFILER 0
+#else
+#define TERRAIN_PROFILER 1
+#endif
+#endif
+
+// CPU time per named stage and frame. Scopes add their time to the current
+// frame; end_frame() moves it into a ring buffer of the last `history`
+// frames. The stages of a frame are meant to be disjoint, so scopes of
+// different stages should not nest. Scopes may run on any thread. While a
+// CTraceRecorder records, every scope is traced as a span as well.
+class CProfiler {
+public:
+  using clock = std::chrono::steady_clock;
+
+  static constexpr int max_stages = 32;
+  static constexpr int history = 256;
+
+  struct StageStats {
+    float min = 0, avg = 0, p99 = 0; // milliseconds
+  };
+
+  class Scope {
+  public:
+    Scope(int stage, const char *name)
+        : m_stage(stage), m_name(name), m_start(clock::now()) {}
+    ~Scope() { instance().add(m_stage, m_name, m_start, clock::now()); }
+
+  private:
+    int m_stage;
+    const char *m_name;
+    clock::time_point m_start;
+  };
+
+  static CProfiler &instance();
+
+  // Index of the stage with this name, registering it on first use.
+  int stage(const char *name);
+  void add(int stage, const char *name, clock::time_point start,
+           clock::time_point end) {
+    auto ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start);
+    m_current[stage].fetch_add(ns.count(), std::memory_order_relaxed);
+    auto &trace = CTraceRecorder::instance();
+    if (trace.recording())
+      trace.span(name, start, end);
+  }
+  // Closes the current frame; its wall time is recorded as well.
+  void end_frame();
+
+  int stage_count() const;
+  std::string stage_name(int stage) const;
+  // Frames in the ring buffer, at most `history`.
+  int frame_count() const { return m_frames; }
+  // Time of stage in the n-th recorded frame, oldest first.
+  float stage_ms(int n, int stage) const;
+  float frame_ms(int n) const;
+  StageStats stats(int stage) const;
+  StageStats frame_stats() const;
+
+private:
+  CProfiler();
+  int slot(int n) const { return (m_next + history - m_frames + n) % history; }
+  StageStats stats_of(const float *samples, int stride) const;
+
+  mutable std::mutex m_mutex; // guards m_names
+  std::vector<std::string> m_names;
+  std::atomic<long long> m_current[max_stages];
+  float m_ms[history][max_stages + 1] = {}; // the last column is the frame
+  int m_next = 0, m_frames = 0;
+  clock::time_point m_frame_start;
+};
+
+#if TERRAIN_PROFILER
+#define PROFILE_CONCAT2(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+// Times the rest of the enclosing block as the stage `name`.
+#define PROFILE_SCOPE(name)                                                    \
+  static const int PROFILE_CONCAT(profile_stage_, __LINE__) =                  \
+      CProfiler::instance().stage(name);                                       \
+  CProfiler::Scope PROFILE_CONCAT(profile_scope_, __LINE__)(                   \
+      PROFILE_CONCAT(profile_stage_, __LINE__), name)
+// The same for a span that is not a block: PROFILE_BEGIN(id, name) starts it
+// and PROFILE_END(id) in the same scope ends it.
+#define PROFILE_BEGIN(id, name)                                                \
+  static const int profile_stage_##id = CProfiler::instance().stage(name);    \
+  static const char *const profile_name_##id = name;                          \
+  auto profile_start_##id = CProfiler::clock::now()
+#define PROFILE_END(id)                                                        \
+  CProfiler::instance().add(profile_stage_##id, profile_name_##id,             \
+                            profile_start_##id, CProfiler::clock::now())
+#define PROFILE_END_FRAME() CProfiler::instance().end_frame()
+// Trace-only span, finer than the profiler stages; a non-negative face is
+// recorded with it.
+#define TRACE_SCOPE(name, face)                                                \
+  CTraceRecorder::Scope PROFILE_CONCAT(trace_scope_, __LINE__)(name, face)
+#define TRACE_COUNTER(name, value)                                             \
+  do {                                                                         \
+    auto &trace = CTraceRecorder::instance();                                  \
+    if (trace.recording())                                                     \
+      trace.counter(name, value);                                              \
+  } while (0)
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_BEGIN(id, name)
+#define PROFILE_END(id)
+#define PROFILE_END_FRAME()
+#define TRACE_SCOPE(name, face)
+#define TRACE_COUNTER(name, value)
+#endif
@@ -1,14 +1,19 @@
 #pragma once
 #include <algorithm>
 #include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <vector>
 
 class QuadTree;
-using QuadTreeRef = std::shared_ptr<QuadTree>;
+struct NodeKey;
 
 struct ITreeVisitorCallback {
   virtual void BeforVisit(QuadTree *qt) {}
@@ -19,12 +24,66 @@ struct ITreeVisitorCallback {
   virtual void AfterRecursioCall(QuadTree *qt, bool is_last, int level) {}
 };
 
+// Compile-time counterpart of ITreeVisitorCallback for QuadTree::visit<>():
+// derive from it and hide the hooks you need, the others compile to nothing.
+struct TreeVisitor {
+  void BeforVisit(QuadTree *qt) {}
+  void AfterVisit(QuadTree *qt) {}
+  void OnLeaf(QuadTree *qt, bool is_last, int level) {}
+  void BeforeRecursioCall(QuadTree *qt, bool is_last, int level) {}
+  void AfterRecursioCall(QuadTree *qt, bool is_last, int level) {}
+};
+
+// Runs an ITreeVisitorCallback through visit<>().
+struct VirtualTreeVisitor {
+  ITreeVisitorCallback *callback;
+
+  void BeforVisit(QuadTree *qt) { callback->BeforVisit(qt); }
+  void AfterVisit(QuadTree *qt) { callback->AfterVisit(qt); }
+  void OnLeaf(QuadTree *qt, bool is_last, int level) {
+    callback->OnLeaf(qt, is_last, level);
+  }
+  void BeforeRecursioCall(QuadTree *qt, bool is_last, int level) {
+    callback->BeforeRecursioCall(qt, is_last, level);
+  }
+  void AfterRecursioCall(QuadTree *qt, bool is_last, int level) {
+    callback->AfterRecursioCall(qt, is_last, level);
+  }
+};
+
 struct color3 {
   double r, g, b;
   color3(double r, double g, double b) : r(r), g(g), b(b) {}
   color3() = default;
 };
 
+// Decides which nodes are invisible. A culled node is neither split nor
+// reported by visit(), so whole subtrees are dropped at once, and the
+// children of a node that is entirely visible are not tested at all.
+// Implementations must be safe to call from several threads.
+struct INodeCuller {
+  enum Visibility { outside, partial, inside };
+  virtual Visibility classify(const QuadTree *qt) const = 0;
+
+  // The culler for the children of a node, or nullptr if nothing below it
+  // can be culled.
+  static const INodeCuller *descend(const INodeCuller *culler,
+                                    Visibility visibility) {
+    return visibility == partial ? culler : nullptr;
+  }
+};
+
+// Decides whether a node is refined further. Without one, split() and
+// refine() use the focus-point distance test of QuadTree::need_split().
+struct ISplitCriterion {
+  virtual bool need_split(const QuadTree *qt) const = 0;
+  // How far a node is past the split threshold, as a ratio: above 1 for
+  // nodes that need a split, larger for those whose split matters more.
+  // Orders the splits of split_budgeted() and sets the merge threshold of
+  // RefineHysteresis.
+  virtual float urgency(const QuadTree *qt) const = 0;
+};
+
 struct IQuadTreeRender {
   virtual void draw_plane(double ox, double oy, double size, color3 color) = 0;
 };
@@ -34,123 +93,789 @@ static color3 rtc = color3(0, 0, 1);
 static color3 lbc = color3(0, 1, 0);
 static color3 rbc = color3(0, 1, 1);
 
-class QuadTree {
-  struct Quad {
-    double ox, oy;
-    color3 color;
-    Quad(double ox, double oy, color3 color) : ox(ox), oy(oy), color(color) {}
-    Quad() = default;
-  };
+// Node colors by QuadTree::m_color: roots, then children 0 to 3.
+static const color3 quadtree_palette[] = {color3(1, 1, 0), lbc, ltc, rtc, rbc};
+
+// The face-space square a tree's root covers, and its depth.
+struct QuadTreeGeometry {
+  int depth = 0;
+  double size = 0;
+  double x = 0, y = 0; // centre
+};
 
+// Arena for quadtree nodes. The four children of a node occupy four
+// consecutive slots and are addressed by the 32-bit index of the first one.
+// Chunks are never returned to the heap, so reset() is O(1) and a tree that
+// fits into the already reserved capacity is built without allocations.
+class QuadTreePool {
 public:
-  QuadTree(int depth, double size, double x, double y, color3 color)
-      : m_depth(depth), m_size(size), m_x(x), m_y(y), m_color(color) {}
-  auto get_offset_by_index(int i) {
-    std::tuple<int, int> offset;
-    switch (i) {
-    case 0:
-      offset = std::make_tuple<int, int>(-1, -1);
-      break;
-    case 1:
-      offset = std::make_tuple<int, int>(-1, 1);
-      break;
-    case 2:
-      offset = std::make_tuple<int, int>(1, -1);
-      break;
-    case 3:
-      offset = std::make_tuple<int, int>(1, 1);
-      break;
-    default:
-      offset = std::make_tuple<int, int>(0, 0);
-      break;
-    }
-    return offset;
+  static constexpr uint32_t npos = ~0u;
+  static constexpr uint32_t chunk_bits = 12;
+  static constexpr uint32_t chunk_size = 1u << chunk_bits;
+
+  QuadTreePool() = default;
+  QuadTreePool(const QuadTreePool &) = delete;
+  QuadTreePool &operator=(const QuadTreePool &) = delete;
+
+  // Shared by all nodes allocated from the pool and by roots pointing to it.
+  const QuadTreeGeometry &geometry() const { return m_geometry; }
+  void set_geometry(const QuadTreeGeometry &geometry) { m_geometry = geometry; }
+
+  inline uint32_t allocate4();
+  // Returns a block of four children to the pool for reuse by allocate4().
+  inline void release4(uint32_t first);
+  inline QuadTree &operator[](uint32_t i);
+  inline const QuadTree &operator[](uint32_t i) const;
+
+  void reset() {
+    m_size = 0;
+    m_free = npos;
+    m_free_blocks = 0;
   }
+  inline void reserve(size_t nodes);
+
+  size_t size() const { return m_size; }
+  // Nodes currently in use, i.e. size() minus released blocks.
+  size_t live() const { return m_size - 4 * m_free_blocks; }
+  size_t capacity() const { return m_chunks.size() * chunk_size; }
+  // Number of heap allocations done by the pool over its lifetime.
+  size_t allocations() const { return m_allocations; }
+
+private:
+  inline void grow();
+
+  std::vector<std::unique_ptr<QuadTree[]>> m_chunks;
+  size_t m_size = 0;
+  size_t m_allocations = 0;
+  uint32_t m_free = npos;
+  size_t m_free_blocks = 0;
+  QuadTreeGeometry m_geometry;
+};
 
-  auto get_node_size(double parent_size) { return 0.5 * parent_size; }
+// Per-level work lists of the breadth-first traversals. Keeping one across
+// calls lets them run without allocations once it has grown to the widest
+// level.
+struct LevelOrderScratch {
+  struct Entry {
+    QuadTree *node;
+    const INodeCuller *culler;
+  };
+  std::vector<Entry> level, next;
+  std::vector<uint8_t> split;
+};
+
+// Split/merge hysteresis of QuadTree::refine(). A leaf splits as in split(),
+// but a node merges only once the criterion clears the threshold by band
+// (d >= (1 + band) * k * L for the distance test) and its children have
+// lived min_lifetime updates, so a focus point wobbling across a boundary
+// does not split and merge the same nodes every frame. Shared by all trees
+// of one pool; the owner advances update once per frame.
+struct RefineHysteresis {
+  double band = 0;
+  uint32_t min_lifetime = 0;
+  uint32_t update = 0;
+  // The update that allocated each block of children, by first child / 4;
+  // kept only while min_lifetime is set.
+  std::vector<uint32_t> born;
+  size_t flips = 0; // nodes split or merged, until the owner resets it
 
-  auto get_origin(QuadTree *parent, int n) {
-    auto offset = get_offset_by_index(n);
-    return std::make_tuple<double, double>(
-        parent->m_x + 0.5 * get_node_size(parent->m_size) * std::get<0>(offset),
-        parent->m_y +
-            0.5 * get_node_size(parent->m_size) * std::get<1>(offset));
+  void on_split(uint32_t first) {
+    flips++;
+    if (!min_lifetime)
+      return;
+    if (first / 4 >= born.size())
+      born.resize(first / 4 + 1);
+    born[first / 4] = update;
+  }
+  // Blocks allocated while min_lifetime was 0 count as old.
+  bool can_merge(uint32_t first) const {
+    return !min_lifetime || first / 4 >= born.size() ||
+           update - born[first / 4] >= min_lifetime;
+  }
+};
+
+class QuadTree {
+public:
+  // The palette entry of a root; child i gets entry i + 1.
+  static constexpr uint8_t root_color = 0;
+
+  QuadTree() = default;
+  // A root spanning the geometry of its pool.
+  QuadTree(int face, QuadTreePool *pool)
+      : m_face(static_cast<uint8_t>(face)), m_pool(pool) {}
+
+  static double split_distance(double x, double y, double ox, double oy,
+                               double L) {
+    return std::max(std::min(std::abs(x - ox), std::abs(x - ox - L)),
+                    std::min(std::abs(y - oy), std::abs(y - oy - L)));
   }
 
   bool need_split(double x, double y, double ox, double oy, double L,
-                  double k) {
-    if (m_depth > 3) {
-      auto d = std::max(std::min(std::abs(x - ox), std::abs(x - ox - L)),
-                        std::min(std::abs(y - oy), std::abs(y - oy - L)));
+                  double k) const {
+    if (depth() > 3) {
+      auto d = split_distance(x, y, ox, oy, L);
       return d < k * L;
     }
     return false;
   }
 
-  Quad get_quad(int i) {
-    color3 color;
-    auto origin = get_origin(this, i);
-    switch (i) {
-    case 0:
-      color = lbc;
-      break;
-    case 1:
-      color = ltc;
-      break;
-    case 2:
-      color = rtc;
-      break;
-    case 3:
-      color = rbc;
-      break;
-    }
-    return Quad(std::get<0>(origin), std::get<1>(origin), color);
+  // Child i lies in the quadrant with x bit i >> 1 and y bit i & 1, so it
+  // appends i to the Morton code.
+  void make_child(int i, QuadTree &child) {
+    assert(m_level < 32);
+    child = QuadTree(m_face, m_pool);
+    child.m_code = m_code << 2 | static_cast<uint64_t>(i);
+    child.m_level = static_cast<uint8_t>(m_level + 1);
+    child.m_color = static_cast<uint8_t>(root_color + 1 + i);
   }
 
-  QuadTreeRef make_child(int i) {
-    auto quad = get_quad(i);
-    return std::make_shared<QuadTree>(m_depth - 1, 0.5 * m_size, quad.ox,
-                                      quad.oy, quad.color);
+  // Geometry, derived from the Morton code and the root geometry of the
+  // pool, so that it stays exact at any depth.
+  inline int depth() const;
+  inline double size() const;
+  inline double x() const;
+  inline double y() const;
+  uint32_t cell_x() const { return morton_compact(m_code >> 1); }
+  uint32_t cell_y() const { return morton_compact(m_code); }
+  inline const color3 &color() const;
+
+  // Every other bit of code, starting with the lowest.
+  static uint32_t morton_compact(uint64_t code) {
+    code &= 0x5555555555555555ull;
+    code = (code | code >> 1) & 0x3333333333333333ull;
+    code = (code | code >> 2) & 0x0f0f0f0f0f0f0f0full;
+    code = (code | code >> 4) & 0x00ff00ff00ff00ffull;
+    code = (code | code >> 8) & 0x0000ffff0000ffffull;
+    code = (code | code >> 16) & 0x00000000ffffffffull;
+    return static_cast<uint32_t>(code);
   }
 
-  void split(double px, double py, double k) {
-    if (need_split(px, py, m_x - 0.5 * m_size, m_y - 0.5 * m_size, m_size, k)) {
-      m_children.resize(4);
+  // Inverse of morton_compact(): spreads the bits of cell to the even ones.
+  static uint64_t morton_spread(uint32_t cell) {
+    uint64_t code = cell;
+    code = (code | code << 16) & 0x0000ffff0000ffffull;
+    code = (code | code << 8) & 0x00ff00ff00ff00ffull;
+    code = (code | code << 4) & 0x0f0f0f0f0f0f0f0full;
+    code = (code | code << 2) & 0x3333333333333333ull;
+    code = (code | code << 1) & 0x5555555555555555ull;
+    return code;
+  }
+
+  inline NodeKey key() const;
+
+  bool is_leaf() const { return m_first_child == QuadTreePool::npos; }
+  QuadTree &child(int i) { return (*m_pool)[m_first_child + i]; }
+  const QuadTree &child(int i) const { return (*m_pool)[m_first_child + i]; }
+
+  inline void split(double px, double py, double k,
+                    const INodeCuller *culler = nullptr);
+
+  // Criterion is an ISplitCriterion; calls through a final class such as
+  // DistanceCriterion are resolved at compile time.
+  template <typename Criterion>
+  void split(const Criterion &criterion, const INodeCuller *culler = nullptr) {
+    auto visibility = culler ? culler->classify(this) : INodeCuller::inside;
+    m_culled = visibility == INodeCuller::outside;
+    if (m_culled)
+      return;
+    if (criterion.need_split(this)) {
+      culler = INodeCuller::descend(culler, visibility);
+      m_first_child = m_pool->allocate4();
       for (int i = 0; i < 4; i++) {
-        m_children[i] = make_child(i);
-        m_children[i]->split(px, py, k);
+        make_child(i, child(i));
+        child(i).split(criterion, culler);
       }
     }
   }
 
+  // Brings an existing tree in line with split(px, py, k, culler): leaves
+  // that now need a split are split, subtrees that no longer do are merged,
+  // subject to hysteresis, and culled subtrees are merged right away. Every
+  // node remembers the focus point travel (odometer) after which its subtree
+  // may change, so subtrees far from any split boundary are skipped without
+  // being visited. The camera is not tracked that way: nodes the culler
+  // cannot decide for the whole subtree, and the ancestors of culled nodes,
+  // are visited on every update. Returns the number of nodes created or
+  // released.
+  size_t refine(double px, double py, double k, double odometer, bool force,
+                RefineHysteresis &hysteresis,
+                const INodeCuller *culler = nullptr) {
+    if (culler) {
+      auto visibility = culler->classify(this);
+      if (visibility == INodeCuller::outside)
+        return refine_culled(odometer, hysteresis);
+      culler = INodeCuller::descend(culler, visibility);
+    }
+    // Back in view, as a leaf.
+    if (m_culled) {
+      m_culled = false;
+      force = true;
+    }
+    if (!force && !culler && odometer < m_deadline)
+      return 0;
+    double size = this->size();
+    double ox = x() - 0.5 * size, oy = y() - 0.5 * size;
+    double merge_k = (1 + hysteresis.band) * k;
+    bool want_split =
+        need_split(px, py, ox, oy, size, is_leaf() ? k : merge_k);
+    // Too young to merge: check again next update, moved or not.
+    bool held = !is_leaf() && !want_split &&
+                !hysteresis.can_merge(m_first_child);
+    want_split = want_split || held;
+    // need_split() is 1-Lipschitz in the focus point (Chebyshev metric), so
+    // the answer for the node's new state cannot flip before the point
+    // travels this far.
+    double margin = std::numeric_limits<double>::infinity();
+    if (depth() > 3)
+      margin = std::abs(split_distance(px, py, ox, oy, size) -
+                        (want_split ? merge_k : k) * size) *
+               (1 - 1e-9);
+    m_deadline = held ? odometer : odometer + margin;
+
+    size_t changed = 0;
+    if (is_leaf()) {
+      if (want_split) {
+        m_first_child = m_pool->allocate4();
+        hysteresis.on_split(m_first_child);
+        changed += 4;
+        for (int i = 0; i < 4; i++) {
+          make_child(i, child(i));
+          changed += child(i).refine(px, py, k, odometer, true, hysteresis,
+                                     culler);
+          m_deadline = std::min(m_deadline, child(i).m_deadline);
+        }
+      }
+    } else if (!want_split) {
+      hysteresis.flips++;
+      changed += merge();
+    } else {
+      for (int i = 0; i < 4; i++) {
+        changed +=
+            child(i).refine(px, py, k, odometer, force, hysteresis, culler);
+        m_deadline = std::min(m_deadline, child(i).m_deadline);
+      }
+    }
+    return changed;
+  }
+
+  // refine() for an arbitrary criterion, whose urgency() stands in for the
+  // distance ratio of the hysteresis band. Nothing is known about how far
+  // the answer is from flipping, so every node is visited and the deadlines
+  // are left stale; the next distance refine() must be forced.
+  size_t refine(const ISplitCriterion &criterion, RefineHysteresis &hysteresis,
+                const INodeCuller *culler = nullptr) {
+    auto visibility = culler ? culler->classify(this) : INodeCuller::inside;
+    if (visibility == INodeCuller::outside)
+      return refine_culled(0, hysteresis);
+    m_culled = false;
+    culler = INodeCuller::descend(culler, visibility);
+    bool want_split;
+    if (is_leaf() || hysteresis.band == 0)
+      want_split = criterion.need_split(this);
+    else
+      want_split = criterion.urgency(this) * (1 + hysteresis.band) > 1;
+    want_split = want_split ||
+                 (!is_leaf() && !hysteresis.can_merge(m_first_child));
+    size_t changed = 0;
+    if (is_leaf()) {
+      if (want_split) {
+        m_first_child = m_pool->allocate4();
+        hysteresis.on_split(m_first_child);
+        changed += 4;
+        for (int i = 0; i < 4; i++) {
+          make_child(i, child(i));
+          changed += child(i).refine(criterion, hysteresis, culler);
+        }
+      }
+    } else if (!want_split) {
+      hysteresis.flips++;
+      changed += merge();
+    } else {
+      for (int i = 0; i < 4; i++)
+        changed += child(i).refine(criterion, hysteresis, culler);
+    }
+    return changed;
+  }
+
+  // A node outside the culler of refine() becomes a culled leaf, as in
+  // split(). Its deadline of odometer keeps its ancestors visited, so that
+  // it is refined again once it is back in view.
+  size_t refine_culled(double odometer, RefineHysteresis &hysteresis) {
+    m_culled = true;
+    m_deadline = odometer;
+    if (is_leaf())
+      return 0;
+    hysteresis.flips++;
+    return merge();
+  }
+
+  // Releases all descendants back to the pool. Returns the number of nodes
+  // released.
+  size_t merge() {
+    if (is_leaf())
+      return 0;
+    size_t released = 4;
+    for (int i = 0; i < 4; i++)
+      released += child(i).merge();
+    m_pool->release4(m_first_child);
+    m_first_child = QuadTreePool::npos;
+    return released;
+  }
+
+  // Virtual-callback traversal, kept for existing callers; ox and oy are
+  // ignored.
   void visit(ITreeVisitorCallback *callback, double ox, double oy, int level) {
-    callback->BeforVisit((this));
-    visit_recursive(callback, ox, oy, level + 1, true);
-    callback->AfterVisit((this));
+    VirtualTreeVisitor adapter{callback};
+    visit(adapter, level);
   }
 
-  void visit_recursive(ITreeVisitorCallback *callback, double ox, double oy,
-                       int level, bool is_last) {
-    using namespace std;
+  // Visitor provides the TreeVisitor hooks; they are called directly and
+  // can be inlined.
+  template <typename Visitor> void visit(Visitor &visitor, int level = 0) {
+    visitor.BeforVisit(this);
+    visit_recursive(visitor, level + 1, true);
+    visitor.AfterVisit(this);
+  }
 
-    if (m_children.size() == 0) {
-      callback->OnLeaf((this), is_last, level);
+  template <typename Visitor>
+  void visit_recursive(Visitor &visitor, int level, bool is_last) {
+    if (m_culled)
+      return;
+    if (is_leaf()) {
+      visitor.OnLeaf(this, is_last, level);
     } else {
-      callback->BeforeRecursioCall((this), is_last, level);
-      for (int i = 0; i < 4; i++) {
-        auto offset = get_offset_by_index(i);
-        auto origin = get_origin(this, i);
-        m_children[i]->visit_recursive(callback, std::get<0>(origin),
-                                       std::get<0>(origin), level + 1, i == 3);
+      visitor.BeforeRecursioCall(this, is_last, level);
+      for (int i = 0; i < 4; i++)
+        child(i).visit_recursive(visitor, level + 1, i == 3);
+      visitor.AfterRecursioCall(this, is_last, level);
+    }
+  }
+
+  // Height limit of visit_iterative() and visit_implicit(). A root's depth()
+  // bounds the height of its tree.
+  static constexpr int max_height = 64;
+
+  // visit() with an explicit stack of fixed capacity instead of recursion:
+  // same order, same hooks.
+  template <typename Visitor>
+  void visit_iterative(Visitor &visitor, int level = 0) {
+    struct Frame {
+      QuadTree *node;
+      int next; // index of the next child to enter
+    };
+    Frame stack[max_height];
+    visitor.BeforVisit(this);
+    level++;
+    if (m_culled) {
+    } else if (is_leaf()) {
+      visitor.OnLeaf(this, true, level);
+    } else {
+      visitor.BeforeRecursioCall(this, true, level);
+      int top = 0;
+      stack[0] = {this, 0};
+      while (top >= 0) {
+        auto &frame = stack[top];
+        if (frame.next == 4) {
+          bool is_last = top == 0 || stack[top - 1].next == 4;
+          visitor.AfterRecursioCall(frame.node, is_last, level + top);
+          top--;
+          continue;
+        }
+        int i = frame.next++;
+        auto &c = frame.node->child(i);
+        if (c.m_culled)
+          continue;
+        if (c.is_leaf()) {
+          visitor.OnLeaf(&c, i == 3, level + top + 1);
+          continue;
+        }
+        visitor.BeforeRecursioCall(&c, i == 3, level + top + 1);
+        assert(top + 1 < max_height);
+        stack[++top] = {&c, 0};
       }
-      callback->AfterRecursioCall((this), is_last, level);
     }
+    visitor.AfterVisit(this);
+  }
+
+  // Reports the leaves split(criterion, culler) would create, with the same
+  // hooks in the same order as visit() on the result, but without building
+  // the tree: only the nodes on the path to the current one exist, on an
+  // explicit stack, so memory stays O(depth) however many leaves there are.
+  // The nodes handed to the visitor are transient and have no children.
+  template <typename Criterion, typename Visitor>
+  void visit_implicit(const Criterion &criterion, Visitor &visitor,
+                      const INodeCuller *culler = nullptr, int level = 0) {
+    struct Frame {
+      QuadTree node;
+      const INodeCuller *culler;
+      int next; // index of the next child to enter
+    };
+    Frame stack[max_height];
+    // Reports the node of frame; returns whether it has children.
+    auto open = [&](Frame &frame, bool is_last, int level) {
+      auto visibility = frame.culler ? frame.culler->classify(&frame.node)
+                                     : INodeCuller::inside;
+      if (visibility == INodeCuller::outside)
+        return false;
+      if (!criterion.need_split(&frame.node)) {
+        visitor.OnLeaf(&frame.node, is_last, level);
+        return false;
+      }
+      visitor.BeforeRecursioCall(&frame.node, is_last, level);
+      frame.culler = INodeCuller::descend(frame.culler, visibility);
+      frame.next = 0;
+      return true;
+    };
+    visitor.BeforVisit(this);
+    level++;
+    stack[0].node = *this;
+    stack[0].culler = culler;
+    int top = open(stack[0], true, level) ? 0 : -1;
+    while (top >= 0) {
+      auto &frame = stack[top];
+      if (frame.next == 4) {
+        bool is_last = top == 0 || stack[top - 1].next == 4;
+        visitor.AfterRecursioCall(&frame.node, is_last, level + top);
+        top--;
+        continue;
+      }
+      int i = frame.next++;
+      assert(top + 1 < max_height);
+      auto &child = stack[top + 1];
+      frame.node.make_child(i, child.node);
+      child.culler = frame.culler;
+      if (open(child, i == 3, level + top + 1))
+        top++;
+    }
+    visitor.AfterVisit(this);
+  }
+
+  // split() one level at a time. Culling, the criterion and the allocations
+  // each run over a whole level in a loop of their own, so the criterion
+  // loop is the place for a batched or vectorized test. Children are
+  // allocated level by level, which is the order visit_breadth_first()
+  // reads them in. Builds the same tree as split().
+  template <typename Criterion>
+  void split_breadth_first(const Criterion &criterion,
+                           const INodeCuller *culler,
+                           LevelOrderScratch &scratch) {
+    auto &level = scratch.level;
+    auto &next = scratch.next;
+    auto &split = scratch.split;
+    level.clear();
+    level.push_back({this, culler});
+    while (!level.empty()) {
+      size_t n = 0;
+      for (auto entry : level) {
+        auto visibility = entry.culler ? entry.culler->classify(entry.node)
+                                       : INodeCuller::inside;
+        entry.node->m_culled = visibility == INodeCuller::outside;
+        entry.culler = INodeCuller::descend(entry.culler, visibility);
+        if (!entry.node->m_culled)
+          level[n++] = entry;
+      }
+      split.resize(n);
+      for (size_t i = 0; i < n; i++)
+        split[i] = criterion.need_split(level[i].node);
+      next.clear();
+      for (size_t i = 0; i < n; i++) {
+        if (!split[i])
+          continue;
+        auto node = level[i].node;
+        node->m_first_child = node->m_pool->allocate4();
+        for (int c = 0; c < 4; c++) {
+          node->make_child(c, node->child(c));
+          next.push_back({&node->child(c), level[i].culler});
+        }
+      }
+      std::swap(level, next);
+    }
+  }
+
+  // Level-order visit: all nodes of a level are handled before the next
+  // one. BeforeRecursioCall is called for inner nodes, AfterRecursioCall is
+  // not. Reports the same leaves as visit(), shallow ones first.
+  template <typename Visitor>
+  void visit_breadth_first(Visitor &visitor, LevelOrderScratch &scratch,
+                           int level = 0) {
+    auto &nodes = scratch.level;
+    auto &next = scratch.next;
+    visitor.BeforVisit(this);
+    nodes.clear();
+    nodes.push_back({this, nullptr});
+    for (level++; !nodes.empty(); level++) {
+      next.clear();
+      for (size_t i = 0; i < nodes.size(); i++) {
+        auto node = nodes[i].node;
+        if (node->m_culled)
+          continue;
+        // Siblings are queued four at a time.
+        bool is_last = node == this || i % 4 == 3;
+        if (node->is_leaf()) {
+          visitor.OnLeaf(node, is_last, level);
+          continue;
+        }
+        visitor.BeforeRecursioCall(node, is_last, level);
+        for (int c = 0; c < 4; c++)
+          next.push_back({&node->child(c), nullptr});
+      }
+      std::swap(nodes, next);
+    }
+    visitor.AfterVisit(this);
   }
 
 public:
-  int m_depth;
-  double m_size;
-  double m_x, m_y;
-  color3 m_color;
-  std::vector<std::shared_ptr<QuadTree>> m_children;
+  uint64_t m_code = 0; // two bits per level below the root
+  uint32_t m_first_child = QuadTreePool::npos;
+  uint8_t m_level = 0; // 0 for the root
+  uint8_t m_face = 0;
+  uint8_t m_color = root_color; // index into quadtree_palette
+  bool m_culled = false;
+  QuadTreePool *m_pool = nullptr;
+  double m_deadline = 0;
+};
+
+static_assert(sizeof(QuadTree) <= 32, "two quadtree nodes per cache line");
+
+// Names a node of one of the face trees independently of where, or whether,
+// it is stored.
+struct NodeKey {
+  uint64_t code; // QuadTree::m_code
+  uint8_t face;
+  uint8_t level;
+
+  static NodeKey from_cell(int face, int level, uint32_t x, uint32_t y) {
+    return {QuadTree::morton_spread(x) << 1 | QuadTree::morton_spread(y),
+            static_cast<uint8_t>(face), static_cast<uint8_t>(level)};
+  }
+
+  uint32_t cell_x() const { return QuadTree::morton_compact(code >> 1); }
+  uint32_t cell_y() const { return QuadTree::morton_compact(code); }
+
+  NodeKey parent() const {
+    assert(level > 0);
+    return {code >> 2, face, static_cast<uint8_t>(level - 1)};
+  }
+  NodeKey child(int i) const {
+    return {code << 2 | static_cast<uint64_t>(i), face,
+            static_cast<uint8_t>(level + 1)};
+  }
+
+  bool operator==(const NodeKey &other) const {
+    return code == other.code && face == other.face && level == other.level;
+  }
+  bool operator!=(const NodeKey &other) const { return !(*this == other); }
+
+  // Position on the face's Z-order curve, at the resolution of level 32.
+  uint64_t z_order() const { return level ? code << (64 - 2 * level) : 0; }
+
+  // Z-order: by face, then along the curve, a node before its descendants.
+  // visit() reports leaves in this order.
+  bool operator<(const NodeKey &other) const {
+    if (face != other.face)
+      return face < other.face;
+    auto a = z_order(), b = other.z_order();
+    return a != b ? a < b : level < other.level;
+  }
+};
+
+NodeKey QuadTree::key() const { return {m_code, m_face, m_level}; }
+
+// The distance test of QuadTree::need_split() as an ISplitCriterion.
+struct DistanceCriterion final : ISplitCriterion {
+  double px = 0, py = 0, k = 1;
+
+  DistanceCriterion() = default;
+  DistanceCriterion(double px, double py, double k) : px(px), py(py), k(k) {}
+
+  bool need_split(const QuadTree *qt) const override {
+    double size = qt->size();
+    return qt->need_split(px, py, qt->x() - 0.5 * size, qt->y() - 0.5 * size,
+                          size, k);
+  }
+
+  float urgency(const QuadTree *qt) const override {
+    double size = qt->size();
+    double d = QuadTree::split_distance(px, py, qt->x() - 0.5 * size,
+                                        qt->y() - 0.5 * size, size);
+    return d > 0 ? static_cast<float>(k * size / d)
+                 : std::numeric_limits<float>::infinity();
+  }
 };
+
+// Work list of split_budgeted(). Keeping one across calls lets it run
+// without allocations once it has grown to the widest frontier.
+struct BudgetScratch {
+  struct Entry {
+    float urgency;
+    QuadTree *node;
+    const ISplitCriterion *criterion;
+    const INodeCuller *culler; // for the node's children
+  };
+  std::vector<Entry> heap;
+};
+
+struct BudgetedSplit {
+  size_t nodes = 0;  // nodes built, roots included
+  size_t denied = 0; // leaves left that need a split
+};
+
+// split() of n trees that share a budget of nodes, roots included. Nodes are
+// split most urgent first across all trees rather than depth first, so the
+// cost is bounded by the budget, O(budget log budget), however deep the
+// criterion wants to go, and the splits a tight budget leaves out are the
+// least urgent ones. Builds the same trees as split() if the budget suffices.
+// cullers may be null.
+inline BudgetedSplit split_budgeted(QuadTree *const *roots,
+                                    const ISplitCriterion *const *criteria,
+                                    const INodeCuller *const *cullers, int n,
+                                    size_t budget, BudgetScratch &scratch) {
+  using Entry = BudgetScratch::Entry;
+  auto &heap = scratch.heap;
+  auto less_urgent = [](const Entry &a, const Entry &b) {
+    return a.urgency < b.urgency;
+  };
+  auto offer = [&](QuadTree *node, const ISplitCriterion *criterion,
+                   const INodeCuller *culler) {
+    auto visibility = culler ? culler->classify(node) : INodeCuller::inside;
+    node->m_culled = visibility == INodeCuller::outside;
+    if (node->m_culled || !criterion->need_split(node))
+      return;
+    heap.push_back({criterion->urgency(node), node, criterion,
+                    INodeCuller::descend(culler, visibility)});
+    std::push_heap(heap.begin(), heap.end(), less_urgent);
+  };
+
+  BudgetedSplit result;
+  result.nodes = static_cast<size_t>(n);
+  heap.clear();
+  for (int i = 0; i < n; i++)
+    offer(roots[i], criteria[i], cullers ? cullers[i] : nullptr);
+  while (!heap.empty() && result.nodes + 4 <= budget) {
+    std::pop_heap(heap.begin(), heap.end(), less_urgent);
+    auto entry = heap.back();
+    heap.pop_back();
+    auto node = entry.node;
+    // Pool chunks never move, so the queued children stay valid.
+    node->m_first_child = node->m_pool->allocate4();
+    result.nodes += 4;
+    for (int c = 0; c < 4; c++) {
+      node->make_child(c, node->child(c));
+      offer(&node->child(c), entry.criterion, entry.culler);
+    }
+  }
+  result.denied = heap.size();
+  return result;
+}
+
+void QuadTree::split(double px, double py, double k,
+                     const INodeCuller *culler) {
+  split(DistanceCriterion(px, py, k), culler);
+}
+
+// A QuadTree kept across frames and brought up to date with update() instead
+// of being rebuilt with split() every frame.
+class PersistentQuadTree {
+public:
+  PersistentQuadTree(int face, QuadTreePool *pool) : m_root(face, pool) {}
+
+  // Splits the leaves that now satisfy need_split and merges the subtrees
+  // that no longer do, as far as hysteresis lets them. Returns the number of
+  // nodes created or released; the work done is proportional to that number
+  // rather than to the tree size, plus the nodes along the culler's edges.
+  size_t update(double px, double py, double k, RefineHysteresis &hysteresis,
+                const INodeCuller *culler = nullptr) {
+    bool force = !m_valid || k != m_k || hysteresis.band != m_band;
+    if (!force)
+      m_odometer += std::max(std::abs(px - m_px), std::abs(py - m_py));
+    m_px = px;
+    m_py = py;
+    m_k = k;
+    m_band = hysteresis.band;
+    m_valid = true;
+    return m_root.refine(px, py, k, m_odometer, force, hysteresis, culler);
+  }
+
+  // The same for another criterion; this visits the whole tree.
+  size_t update(const ISplitCriterion &criterion, RefineHysteresis &hysteresis,
+                const INodeCuller *culler = nullptr) {
+    m_valid = false;
+    return m_root.refine(criterion, hysteresis, culler);
+  }
+
+  void clear() {
+    m_root.merge();
+    m_valid = false;
+  }
+
+  QuadTree &root() { return m_root; }
+
+private:
+  QuadTree m_root;
+  double m_px = 0, m_py = 0, m_k = 0, m_band = 0;
+  double m_odometer = 0;
+  bool m_valid = false;
+};
+
+int QuadTree::depth() const { return m_pool->geometry().depth - m_level; }
+
+double QuadTree::size() const {
+  // 2^-m_level, built directly instead of through ldexp().
+  uint64_t bits = static_cast<uint64_t>(1023 - m_level) << 52;
+  double scale;
+  std::memcpy(&scale, &bits, sizeof(scale));
+  return m_pool->geometry().size * scale;
+}
+
+double QuadTree::x() const {
+  auto &root = m_pool->geometry();
+  return root.x + (cell_x() + 0.5) * size() - 0.5 * root.size;
+}
+
+double QuadTree::y() const {
+  auto &root = m_pool->geometry();
+  return root.y + (cell_y() + 0.5) * size() - 0.5 * root.size;
+}
+
+const color3 &QuadTree::color() const { return quadtree_palette[m_color]; }
+
+uint32_t QuadTreePool::allocate4() {
+  if (m_free != npos) {
+    auto first = m_free;
+    m_free = (*this)[first].m_first_child;
+    m_free_blocks--;
+    return first;
+  }
+  if (m_size + 4 > capacity())
+    grow();
+  auto first = static_cast<uint32_t>(m_size);
+  m_size += 4;
+  return first;
+}
+
+void QuadTreePool::release4(uint32_t first) {
+  (*this)[first].m_first_child = m_free;
+  m_free = first;
+  m_free_blocks++;
+}
+
+QuadTree &QuadTreePool::operator[](uint32_t i) {
+  assert(i < m_size);
+  return m_chunks[i >> chunk_bits][i & (chunk_size - 1)];
+}
+
+const QuadTree &QuadTreePool::operator[](uint32_t i) const {
+  assert(i < m_size);
+  return m_chunks[i >> chunk_bits][i & (chunk_size - 1)];
+}
+
+void QuadTreePool::reserve(size_t nodes) {
+  while (capacity() < nodes)
+    grow();
+}
+
+void QuadTreePool::grow() {
+  assert(capacity() + chunk_size <= npos);
+  m_chunks.emplace_back(new QuadTree[chunk_size]);
+  m_allocations++;
+}
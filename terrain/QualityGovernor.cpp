@@ -0,0 +1,131 @@
+#include "QualityGovernor.h"
+
+#include <algorithm>
+
+namespace {
+// One step of each knob.
+const float k_step = 0.1f;
+const float pixel_error_factor = 1.25f;
+// Weight of the newest frame in the smoothed cost.
+const double smoothing = 0.2;
+const int max_backoff = 32;
+} // namespace
+
+void CQualityGovernor::reset(const Quality &ceiling) {
+  m_quality = ceiling;
+  m_state = State::steady;
+  m_has_sample = false;
+  m_settle = 0;
+  m_raise_hold = 0;
+  m_backoff = 1;
+  m_since_raise = 1 << 30;
+  m_at_floor = false;
+  m_at_ceiling = true;
+}
+
+void CQualityGovernor::update(double cost_ms, const Quality &ceiling,
+                              SplitPolicy policy) {
+  // Follow the sliders down at once.
+  m_quality.k = std::min(m_quality.k, ceiling.k);
+  m_quality.depth = std::min(m_quality.depth, ceiling.depth);
+  m_quality.pixel_error = std::max(m_quality.pixel_error, ceiling.pixel_error);
+
+  m_smoothed_ms = m_has_sample
+                      ? m_smoothed_ms + smoothing * (cost_ms - m_smoothed_ms)
+                      : cost_ms;
+  m_has_sample = true;
+  if (m_raise_hold > 0)
+    m_raise_hold--;
+  if (m_since_raise < (1 << 30))
+    m_since_raise++;
+  // The last raise held.
+  if (m_since_raise == 2 * settle_frames + 1)
+    m_backoff = 1;
+
+  if (m_settle > 0) {
+    m_settle--;
+    m_state = State::settling;
+  } else if (m_smoothed_ms > target_ms) {
+    // Further above the target, bigger steps.
+    int steps = std::min(1 + int(4 * (m_smoothed_ms / target_ms - 1)), 4);
+    bool changed = false;
+    for (int i = 0; i < steps && lower(ceiling, policy); i++)
+      changed = true;
+    m_state = changed ? State::lowering : State::steady;
+    if (changed) {
+      if (m_since_raise <= 2 * settle_frames)
+        m_backoff = std::min(2 * m_backoff, max_backoff);
+      m_since_raise = 1 << 30;
+      m_settle = settle_frames;
+      m_raise_hold = m_backoff * settle_frames;
+    }
+  } else if (m_smoothed_ms < (1 - band) * target_ms && m_raise_hold == 0 &&
+             raise(ceiling, policy)) {
+    m_state = State::raising;
+    m_settle = settle_frames;
+    m_since_raise = 0;
+  } else {
+    m_state = State::steady;
+  }
+
+  m_at_ceiling = m_quality.k >= ceiling.k && m_quality.depth >= ceiling.depth &&
+                 m_quality.pixel_error <= ceiling.pixel_error;
+  bool knob_at_limit = policy == SplitPolicy::distance
+                           ? m_quality.k <= min_k
+                           : m_quality.pixel_error >= max_pixel_error;
+  m_at_floor =
+      knob_at_limit && m_quality.depth <= std::min(min_depth, ceiling.depth);
+}
+
+const char *CQualityGovernor::state_name(State state) {
+  switch (state) {
+  case State::steady:
+    return "steady";
+  case State::lowering:
+    return "lowering";
+  case State::raising:
+    return "raising";
+  case State::settling:
+    return "settling";
+  }
+  return "";
+}
+
+bool CQualityGovernor::lower(const Quality &ceiling, SplitPolicy policy) {
+  // The knob of the split criterion first, it coarsens the whole planet a
+  // little; then the depth, which only removes the finest levels.
+  if (policy == SplitPolicy::distance && m_quality.k > min_k) {
+    m_quality.k = std::max(m_quality.k - k_step, min_k);
+    return true;
+  }
+  if (policy == SplitPolicy::screen_space &&
+      m_quality.pixel_error < max_pixel_error) {
+    m_quality.pixel_error =
+        std::min(m_quality.pixel_error * pixel_error_factor, max_pixel_error);
+    return true;
+  }
+  if (m_quality.depth > std::min(min_depth, ceiling.depth)) {
+    m_quality.depth--;
+    return true;
+  }
+  return false;
+}
+
+bool CQualityGovernor::raise(const Quality &ceiling, SplitPolicy policy) {
+  // In the opposite order of lower().
+  if (m_quality.depth < ceiling.depth) {
+    m_quality.depth++;
+    return true;
+  }
+  if (policy == SplitPolicy::distance && m_quality.k < ceiling.k) {
+    m_quality.k = std::min(m_quality.k + k_step, ceiling.k);
+    return true;
+  }
+  if (policy == SplitPolicy::screen_space &&
+      m_quality.pixel_error > ceiling.pixel_error) {
+    m_quality.pixel_error = std::max(
+        m_quality.pixel_error / pixel_error_factor, ceiling.pixel_error);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "Planet.h"
+
+// Closed-loop control of the LOD quality: holds the cost of a frame near a
+// target by lowering and raising the split factor, the pixel error threshold
+// and the maximum depth, one step at a time. The user's settings are the
+// ceiling; the governor never goes above them.
+//
+// Hysteresis keeps it from oscillating: quality goes down when the smoothed
+// cost is above the target, but only goes up again once the cost is below
+// (1 - band) * target. After each change it waits settle_frames frames for
+// the cost to reflect it. A step can change the cost by more than the band,
+// e.g. one more level of depth; if a raise has to be taken back right away,
+// the governor waits twice as long before it tries again.
+class CQualityGovernor {
+public:
+  struct Quality {
+    float k = 1.5f;
+    int depth = 16;
+    float pixel_error = 2;
+  };
+
+  enum class State { steady, lowering, raising, settling };
+
+  // The quality the governor starts from and goes back to when the cost
+  // allows it.
+  void reset(const Quality &ceiling);
+  // Feeds the cost of a frame; quality() is then the one to use next.
+  // policy selects the knob: k for distance, pixel_error for screen_space;
+  // depth goes down only once that knob is at its limit.
+  void update(double cost_ms, const Quality &ceiling, SplitPolicy policy);
+
+  const Quality &quality() const { return m_quality; }
+  State state() const { return m_state; }
+  static const char *state_name(State state);
+  double smoothed_ms() const { return m_smoothed_ms; }
+  bool at_floor() const { return m_at_floor; }
+  bool at_ceiling() const { return m_at_ceiling; }
+
+  float target_ms = 16.6f;
+  float band = 0.2f;
+  int settle_frames = 10;
+  // Limits of the lowered quality.
+  float min_k = 1;
+  float max_pixel_error = 16;
+  int min_depth = 4;
+
+private:
+  bool lower(const Quality &ceiling, SplitPolicy policy);
+  bool raise(const Quality &ceiling, SplitPolicy policy);
+
+  Quality m_quality;
+  State m_state = State::steady;
+  double m_smoothed_ms = 0;
+  bool m_has_sample = false;
+  int m_settle = 0;     // frames left before the next change
+  int m_raise_hold = 0; // frames left before the next raise
+  int m_backoff = 1;    // m_raise_hold after a lowering, in settle_frames
+  int m_since_raise = 1 << 30;
+  bool m_at_floor = false;
+  bool m_at_ceiling = true;
+};
@@ -0,0 +1,176 @@
+#include "Replay.h"
+
+#include <cassert>
+#include <cstring>
+
+namespace {
+const char magic[4] = {'T', 'R', 'P', 'L'};
+const uint32_t version = 3;
+// A version 1 frame holds 14 floats (position, rotation, fov, point, origin,
+// k, size, pixel_error), the i32 depth and 4 bytes (mode, policy and the two
+// culling flags). Version 2 appends the u32 node_budget, version 3 the float
+// merge_band and the i32 min_lifetime.
+const size_t v1_frame_bytes = 14 * 4 + 4 + 4;
+const size_t v2_frame_bytes = v1_frame_bytes + 4;
+const size_t frame_bytes = v2_frame_bytes + 4 + 4;
+
+// Fields are stored as raw 32-bit little-endian words; every platform we
+// build for is little-endian already.
+struct Writer {
+  unsigned char *p;
+  void word(const void *v) {
+    std::memcpy(p, v, 4);
+    p += 4;
+  }
+  void f(float v) { word(&v); }
+  void i(int32_t v) { word(&v); }
+  void u(uint32_t v) { word(&v); }
+  void b(uint8_t v) { *p++ = v; }
+};
+
+struct Reader {
+  const unsigned char *p;
+  void word(void *v) {
+    std::memcpy(v, p, 4);
+    p += 4;
+  }
+  float f() {
+    float v;
+    word(&v);
+    return v;
+  }
+  int32_t i() {
+    int32_t v;
+    word(&v);
+    return v;
+  }
+  uint32_t u() {
+    uint32_t v;
+    word(&v);
+    return v;
+  }
+  uint8_t b() { return *p++; }
+};
+} // namespace
+
+LodSettings replay_settings(const ReplayFrame &frame, CCamera &camera,
+                            int viewport_height) {
+  camera.setPosition(frame.position);
+  camera.setRotation(frame.rotation);
+  camera.FOV = frame.fov;
+  camera.updateCameraVectors();
+
+  LodSettings settings;
+  settings.depth = frame.depth;
+  settings.size = frame.size;
+  settings.origin = frame.origin;
+  settings.k = frame.k;
+  settings.point = frame.point;
+  settings.mode = frame.mode;
+  settings.frustum_cull = frame.frustum_cull;
+  settings.frustum = camera.getFrustumPlanes();
+  settings.horizon_cull = frame.horizon_cull;
+  settings.eye = camera.getPosition();
+  settings.policy = frame.policy;
+  settings.pixel_error = frame.pixel_error;
+  settings.fov = frame.fov;
+  settings.viewport_height = viewport_height;
+  settings.node_budget = frame.node_budget;
+  settings.merge_band = frame.merge_band;
+  settings.min_lifetime = frame.min_lifetime;
+  return settings;
+}
+
+bool CReplayWriter::open(const std::string &path) {
+  close();
+  m_file = fopen(path.c_str(), "wb");
+  if (!m_file)
+    return false;
+  m_path = path;
+  m_frames = 0;
+  fwrite(magic, 1, 4, m_file);
+  fwrite(&version, 4, 1, m_file);
+  return true;
+}
+
+void CReplayWriter::write(const ReplayFrame &frame) {
+  if (!m_file)
+    return;
+  unsigned char bytes[frame_bytes] = {};
+  Writer w{bytes};
+  for (int c = 0; c < 3; c++)
+    w.f(frame.position[c]);
+  for (int c = 0; c < 3; c++)
+    w.f(frame.rotation[c]);
+  w.f(frame.fov);
+  w.f(frame.point.x);
+  w.f(frame.point.y);
+  w.f(frame.origin.x);
+  w.f(frame.origin.y);
+  w.f(frame.k);
+  w.f(frame.size);
+  w.f(frame.pixel_error);
+  w.i(frame.depth);
+  w.b(static_cast<uint8_t>(frame.mode));
+  w.b(static_cast<uint8_t>(frame.policy));
+  w.b(frame.frustum_cull);
+  w.b(frame.horizon_cull);
+  w.u(frame.node_budget);
+  w.f(frame.merge_band);
+  w.i(frame.min_lifetime);
+  assert(w.p == bytes + frame_bytes);
+  fwrite(bytes, 1, frame_bytes, m_file);
+  m_frames++;
+}
+
+void CReplayWriter::close() {
+  if (m_file)
+    fclose(m_file);
+  m_file = nullptr;
+}
+
+bool read_replay(const std::string &path, std::vector<ReplayFrame> &frames) {
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file)
+    return false;
+  char header[4];
+  uint32_t file_version = 0;
+  bool ok = fread(header, 1, 4, file) == 4 &&
+            std::memcmp(header, magic, 4) == 0 &&
+            fread(&file_version, 4, 1, file) == 1 &&
+            file_version >= 1 && file_version <= version;
+  size_t size = file_version == 1   ? v1_frame_bytes
+                : file_version == 2 ? v2_frame_bytes
+                                    : frame_bytes;
+  unsigned char bytes[frame_bytes];
+  while (ok && fread(bytes, 1, size, file) == size) {
+    Reader r{bytes};
+    ReplayFrame frame;
+    for (int c = 0; c < 3; c++)
+      frame.position[c] = r.f();
+    for (int c = 0; c < 3; c++)
+      frame.rotation[c] = r.f();
+    frame.fov = r.f();
+    frame.point.x = r.f();
+    frame.point.y = r.f();
+    frame.origin.x = r.f();
+    frame.origin.y = r.f();
+    frame.k = r.f();
+    frame.size = r.f();
+    frame.pixel_error = r.f();
+    frame.depth = r.i();
+    frame.mode = static_cast<LodMode>(r.b());
+    frame.policy = static_cast<SplitPolicy>(r.b());
+    frame.frustum_cull = r.b() != 0;
+    frame.horizon_cull = r.b() != 0;
+    if (file_version > 1)
+      frame.node_budget = r.u();
+    if (file_version > 2) {
+      frame.merge_band = r.f();
+      frame.min_lifetime = r.i();
+    }
+    frames.push_back(frame);
+  }
+  fclose(file);
+  return ok;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "Camera.h"
+#include "Planet.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Everything the LOD and mesh passes of one viewer frame depend on. Recorded
+// per frame, it makes a session replayable without a window or a clock.
+struct ReplayFrame {
+  glm::vec3 position{0, 0, 0}; // CCamera::transform
+  glm::vec3 rotation{0, 0, 0};
+  float fov = 45;
+  glm::vec2 point{0, 0}; // focus point
+  glm::vec2 origin{0, 0};
+  float k = 1.5f;
+  float size = 4.f;
+  float pixel_error = 2;
+  int32_t depth = 16;
+  LodMode mode = LodMode::incremental;
+  SplitPolicy policy = SplitPolicy::distance;
+  bool frustum_cull = false;
+  bool horizon_cull = false;
+  uint32_t node_budget = 1 << 18; // LodSettings::node_budget
+  float merge_band = 0;
+  int32_t min_lifetime = 0;
+};
+
+// Points camera along the frame's view and returns the frame's LOD settings.
+LodSettings replay_settings(const ReplayFrame &frame, CCamera &camera,
+                            int viewport_height);
+
+// Replay files start with a small header followed by fixed-size frames of
+// little-endian fields.
+class CReplayWriter {
+public:
+  ~CReplayWriter() { close(); }
+
+  bool open(const std::string &path);
+  void write(const ReplayFrame &frame);
+  void close();
+  bool is_open() const { return m_file != nullptr; }
+  size_t frames() const { return m_frames; }
+  const std::string &path() const { return m_path; }
+
+private:
+  FILE *m_file = nullptr;
+  size_t m_frames = 0;
+  std::string m_path;
+};
+
+bool read_replay(const std::string &path, std::vector<ReplayFrame> &frames);
@@ -0,0 +1,35 @@
+#include "ScreenSpaceError.h"
+
+#include <cmath>
+#include <limits>
+
+void CScreenSpaceError::set(Face face, float radius, glm::vec3 eye, float fov,
+                            int viewport_height, float pixel_error) {
+  m_face = face;
+  m_radius = radius;
+  m_eye = eye;
+  m_pixels_per_unit =
+      viewport_height / (2 * std::tan(0.5f * glm::radians(fov)));
+  m_pixel_error = pixel_error;
+}
+
+bool CScreenSpaceError::need_split(const QuadTree *qt) const {
+  // The same minimum leaf size as the distance test.
+  if (qt->depth() <= 3)
+    return false;
+  return projected_error(qt->x(), qt->y(), qt->size()) > m_pixel_error;
+}
+
+float CScreenSpaceError::urgency(const QuadTree *qt) const {
+  return projected_error(qt->x(), qt->y(), qt->size()) / m_pixel_error;
+}
+
+float CScreenSpaceError::projected_error(double ox, double oy,
+                                         double size) const {
+  auto bounds = patch_bounds(m_face, ox, oy, size, m_radius);
+  float distance = glm::length(bounds.center - m_eye) - bounds.radius;
+  if (distance <= 0)
+    return std::numeric_limits<float>::infinity();
+  float sag = m_radius * (1 - bounds.cone_cos);
+  return sag * m_pixels_per_unit / distance;
+}
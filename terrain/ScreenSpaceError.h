@@ -0,0 +1,27 @@
+#pragma once
+#include "CubeSphere.h"
+#include "QuadTree.h"
+
+// Splits the nodes of one face tree whose geometric error, projected onto the
+// screen, exceeds a pixel threshold. The geometric error of a node is how far
+// its flat quad sags below the sphere; it is projected from the point of the
+// node's bounding sphere nearest to the eye.
+class CScreenSpaceError : public ISplitCriterion {
+public:
+  // fov is the vertical field of view in degrees, as in CCamera::FOV.
+  void set(Face face, float radius, glm::vec3 eye, float fov,
+           int viewport_height, float pixel_error);
+
+  bool need_split(const QuadTree *qt) const override;
+  float urgency(const QuadTree *qt) const override;
+
+  // Error in pixels of the node (ox, oy, size) when drawn unsplit.
+  float projected_error(double ox, double oy, double size) const;
+
+private:
+  Face m_face = Face::right;
+  float m_radius = 1;
+  glm::vec3 m_eye{0, 0, 0};
+  float m_pixels_per_unit = 1; // at distance 1
+  float m_pixel_error = 1;
+};
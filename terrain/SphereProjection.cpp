@@ -0,0 +1,201 @@
+#include "SphereProjection.h"
+
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) ||             \
+    defined(_M_IX86)
+#define TERRAIN_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__)
+#define TARGET_SSE __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE
+#define TARGET_AVX2
+#endif
+
+namespace {
+// Face frame with the normal already scaled by the radius. Because the axes
+// are signed unit vectors, u * U + v * V + N evaluates to the exact cube
+// point, whichever path computes it.
+struct Frame {
+  float ux, uy, uz;
+  float vx, vy, vz;
+  float nx, ny, nz;
+};
+
+Frame make_frame(Face f, float radius) {
+  auto frame = face_frame(f);
+  return {frame.u.x,          frame.u.y,          frame.u.z,
+          frame.v.x,          frame.v.y,          frame.v.z,
+          frame.n.x * radius, frame.n.y * radius, frame.n.z * radius};
+}
+
+void project_scalar(const Frame &f, const float *u, const float *v, size_t n,
+                    float radius, float *x, float *y, float *z) {
+  for (size_t i = 0; i < n; i++) {
+    float cx = f.ux * u[i] + f.vx * v[i] + f.nx;
+    float cy = f.uy * u[i] + f.vy * v[i] + f.ny;
+    float cz = f.uz * u[i] + f.vz * v[i] + f.nz;
+    float s = radius / std::sqrt(cx * cx + cy * cy + cz * cz);
+    x[i] = cx * s;
+    y[i] = cy * s;
+    z[i] = cz * s;
+  }
+}
+
+#ifdef TERRAIN_X86
+TARGET_SSE void project_sse(const Frame &f, const float *u, const float *v,
+                            size_t n, float radius, float *x, float *y,
+                            float *z) {
+  const __m128 ux = _mm_set1_ps(f.ux), uy = _mm_set1_ps(f.uy),
+               uz = _mm_set1_ps(f.uz);
+  const __m128 vx = _mm_set1_ps(f.vx), vy = _mm_set1_ps(f.vy),
+               vz = _mm_set1_ps(f.vz);
+  const __m128 nx = _mm_set1_ps(f.nx), ny = _mm_set1_ps(f.ny),
+               nz = _mm_set1_ps(f.nz);
+  const __m128 r = _mm_set1_ps(radius);
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 pu = _mm_loadu_ps(u + i), pv = _mm_loadu_ps(v + i);
+    __m128 cx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ux, pu), _mm_mul_ps(vx, pv)), nx);
+    __m128 cy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(uy, pu), _mm_mul_ps(vy, pv)), ny);
+    __m128 cz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(uz, pu), _mm_mul_ps(vz, pv)), nz);
+    __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, cx), _mm_mul_ps(cy, cy)),
+                             _mm_mul_ps(cz, cz));
+    __m128 s = _mm_div_ps(r, _mm_sqrt_ps(len2));
+    _mm_storeu_ps(x + i, _mm_mul_ps(cx, s));
+    _mm_storeu_ps(y + i, _mm_mul_ps(cy, s));
+    _mm_storeu_ps(z + i, _mm_mul_ps(cz, s));
+  }
+  project_scalar(f, u + i, v + i, n - i, radius, x + i, y + i, z + i);
+}
+
+TARGET_AVX2 void project_avx2(const Frame &f, const float *u, const float *v,
+                              size_t n, float radius, float *x, float *y,
+                              float *z) {
+  const __m256 ux = _mm256_set1_ps(f.ux), uy = _mm256_set1_ps(f.uy),
+               uz = _mm256_set1_ps(f.uz);
+  const __m256 vx = _mm256_set1_ps(f.vx), vy = _mm256_set1_ps(f.vy),
+               vz = _mm256_set1_ps(f.vz);
+  const __m256 nx = _mm256_set1_ps(f.nx), ny = _mm256_set1_ps(f.ny),
+               nz = _mm256_set1_ps(f.nz);
+  const __m256 r = _mm256_set1_ps(radius);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 pu = _mm256_loadu_ps(u + i), pv = _mm256_loadu_ps(v + i);
+    __m256 cx = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(ux, pu), _mm256_mul_ps(vx, pv)), nx);
+    __m256 cy = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(uy, pu), _mm256_mul_ps(vy, pv)), ny);
+    __m256 cz = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(uz, pu), _mm256_mul_ps(vz, pv)), nz);
+    __m256 len2 = _mm256_add_ps(
+        _mm256_add_ps(_mm256_mul_ps(cx, cx), _mm256_mul_ps(cy, cy)),
+        _mm256_mul_ps(cz, cz));
+    __m256 s = _mm256_div_ps(r, _mm256_sqrt_ps(len2));
+    _mm256_storeu_ps(x + i, _mm256_mul_ps(cx, s));
+    _mm256_storeu_ps(y + i, _mm256_mul_ps(cy, s));
+    _mm256_storeu_ps(z + i, _mm256_mul_ps(cz, s));
+  }
+  project_scalar(f, u + i, v + i, n - i, radius, x + i, y + i, z + i);
+}
+
+bool cpu_has_sse2() {
+#if defined(_M_X64) || defined(__x86_64__)
+  return true;
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 1);
+  return (info[3] & (1 << 26)) != 0;
+#else
+  return __builtin_cpu_supports("sse2");
+#endif
+}
+
+bool cpu_has_avx2() {
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7)
+    return false;
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  // The OS has to save the YMM registers on context switches.
+  if (!osxsave || !avx || (_xgetbv(0) & 6) != 6)
+    return false;
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+} // namespace
+
+bool simd_path_supported(SimdPath path) {
+#ifdef TERRAIN_X86
+  static const bool sse = cpu_has_sse2();
+  static const bool avx2 = cpu_has_avx2();
+#else
+  static const bool sse = false;
+  static const bool avx2 = false;
+#endif
+  switch (path) {
+  case SimdPath::scalar:
+    return true;
+  case SimdPath::sse:
+    return sse;
+  case SimdPath::avx2:
+    return avx2;
+  }
+  return false;
+}
+
+SimdPath best_simd_path() {
+  static const SimdPath best = simd_path_supported(SimdPath::avx2)
+                                   ? SimdPath::avx2
+                               : simd_path_supported(SimdPath::sse)
+                                   ? SimdPath::sse
+                                   : SimdPath::scalar;
+  return best;
+}
+
+const char *simd_path_name(SimdPath path) {
+  switch (path) {
+  case SimdPath::scalar:
+    return "scalar";
+  case SimdPath::sse:
+    return "sse";
+  case SimdPath::avx2:
+    return "avx2";
+  }
+  return "unknown";
+}
+
+void project_face_to_sphere(Face f, const float *u, const float *v, size_t n,
+                            float radius, float *x, float *y, float *z,
+                            SimdPath path) {
+  auto frame = make_frame(f, radius);
+  if (!simd_path_supported(path))
+    path = SimdPath::scalar;
+  switch (path) {
+#ifdef TERRAIN_X86
+  case SimdPath::avx2:
+    project_avx2(frame, u, v, n, radius, x, y, z);
+    return;
+  case SimdPath::sse:
+    project_sse(frame, u, v, n, radius, x, y, z);
+    return;
+#endif
+  default:
+    project_scalar(frame, u, v, n, radius, x, y, z);
+    return;
+  }
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include "CubeSphere.h"
+
+#include <cstddef>
+
+// Instruction set used by project_face_to_sphere(). All paths evaluate the
+// same operations in the same order without contraction, so they produce
+// bit-identical results.
+enum class SimdPath { scalar, sse, avx2 };
+
+// Best path supported by the CPU we are running on.
+SimdPath best_simd_path();
+bool simd_path_supported(SimdPath path);
+const char *simd_path_name(SimdPath path);
+
+// Maps n face-space points (u[i], v[i]) of face f onto the cube of half extent
+// radius and pushes them out onto the sphere of the same radius. The result is
+// written in structure-of-arrays form to x, y and z.
+void project_face_to_sphere(Face f, const float *u, const float *v, size_t n,
+                            float radius, float *x, float *y, float *z,
+                            SimdPath path = best_simd_path());
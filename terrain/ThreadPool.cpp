@@ -0,0 +1,155 @@
+#include "ThreadPool.h"
+
+namespace {
+struct WorkerSlot {
+  const WorkStealingPool *pool = nullptr;
+  unsigned index = 0;
+};
+thread_local WorkerSlot tls_worker;
+} // namespace
+
+WorkStealingPool::WorkStealingPool(unsigned participants) {
+  if (participants == 0)
+    participants = 1;
+  for (unsigned i = 0; i < participants; i++)
+    m_queues.emplace_back(new Queue);
+  m_stats_start = clock::now();
+  for (unsigned i = 1; i < participants; i++)
+    m_threads.emplace_back([this, i] { worker_loop(i); });
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  {
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (auto &thread : m_threads)
+    thread.join();
+}
+
+unsigned WorkStealingPool::current_index() const {
+  return tls_worker.pool == this ? tls_worker.index : 0;
+}
+
+void WorkStealingPool::Queue::push_back(const Task &task) {
+  if (count == ring.size()) {
+    std::vector<Task> grown(ring.empty() ? 64 : 2 * ring.size());
+    for (size_t i = 0; i < count; i++)
+      grown[i] = ring[(head + i) % ring.size()];
+    ring.swap(grown);
+    head = 0;
+  }
+  ring[(head + count) % ring.size()] = task;
+  count++;
+}
+
+WorkStealingPool::Task WorkStealingPool::Queue::pop_back() {
+  count--;
+  return ring[(head + count) % ring.size()];
+}
+
+WorkStealingPool::Task WorkStealingPool::Queue::pop_front() {
+  auto task = ring[head];
+  head = (head + 1) % ring.size();
+  count--;
+  return task;
+}
+
+void WorkStealingPool::push(const Task &task) {
+  task.group->m_pending.fetch_add(1, std::memory_order_relaxed);
+  auto &queue = *m_queues[current_index()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.push_back(task);
+  }
+  // Either this thread sees a worker that is going to sleep, or that worker
+  // sees the task; both sides use sequentially consistent operations.
+  m_queued.fetch_add(1);
+  if (m_sleeping.load() == 0)
+    return;
+  {
+    // Taking the lock orders the push against a worker that is just about to
+    // fall asleep, so the wake-up cannot get lost.
+    std::lock_guard<std::mutex> lock(m_sleep_mutex);
+  }
+  m_wake.notify_one();
+}
+
+void WorkStealingPool::wait(TaskGroup &group) {
+  unsigned index = current_index();
+  Task task;
+  while (!group.done()) {
+    if (pop(index, task) || steal(index, task))
+      execute(index, task);
+    else
+      std::this_thread::yield();
+  }
+}
+
+bool WorkStealingPool::pop(unsigned index, Task &task) {
+  auto &queue = *m_queues[index];
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.count == 0)
+    return false;
+  task = queue.pop_back();
+  m_queued.fetch_sub(1, std::memory_order_relaxed);
+  return true;
+}
+
+bool WorkStealingPool::steal(unsigned index, Task &task) {
+  for (size_t n = 1; n < m_queues.size(); n++) {
+    auto &queue = *m_queues[(index + n) % m_queues.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.count == 0)
+      continue;
+    task = queue.pop_front();
+    m_queued.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+void WorkStealingPool::execute(unsigned index, Task &task) {
+  auto start = clock::now();
+  task.call(task.storage);
+  auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      clock::now() - start);
+  m_queues[index]->busy_ns.fetch_add(elapsed.count(),
+                                     std::memory_order_relaxed);
+  task.group->m_pending.fetch_sub(1, std::memory_order_release);
+}
+
+void WorkStealingPool::worker_loop(unsigned index) {
+  tls_worker.pool = this;
+  tls_worker.index = index;
+  Task task;
+  while (true) {
+    if (pop(index, task) || steal(index, task)) {
+      execute(index, task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(m_sleep_mutex);
+    m_sleeping.fetch_add(1);
+    m_wake.wait(lock, [this] { return m_stop || m_queued.load() > 0; });
+    m_sleeping.fetch_sub(1);
+    if (m_stop)
+      return;
+  }
+}
+
+std::vector<double> WorkStealingPool::utilization() const {
+  auto wall = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  clock::now() - m_stats_start)
+                  .count();
+  std::vector<double> result;
+  for (auto &queue : m_queues)
+    result.push_back(wall > 0 ? double(queue->busy_ns.load()) / wall : 0.0);
+  return result;
+}
+
+void WorkStealingPool::reset_stats() {
+  for (auto &queue : m_queues)
+    queue->busy_ns = 0;
+  m_stats_start = clock::now();
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Work-stealing thread pool. Every participant owns a deque: it pushes and
+// pops its own work at the back and steals from the front of the others.
+// Slot 0 belongs to the thread that calls wait(), which helps executing tasks
+// instead of blocking, so a pool of N participants starts N - 1 threads.
+class WorkStealingPool {
+public:
+  // Tasks spawned into a group may spawn further tasks into the same group;
+  // wait() returns once all of them have finished.
+  class TaskGroup {
+  public:
+    bool done() const { return m_pending.load(std::memory_order_acquire) == 0; }
+
+  private:
+    friend class WorkStealingPool;
+    std::atomic<int> m_pending{0};
+  };
+
+  explicit WorkStealingPool(
+      unsigned participants = std::thread::hardware_concurrency());
+  ~WorkStealingPool();
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+  // Queues fn() into the calling participant's deque. Tasks are stored in
+  // place, so fn must be trivially copyable and at most Task::capacity bytes
+  // (a lambda capturing pointers and numbers by value); queuing then never
+  // allocates once the deques have grown to the working set.
+  template <typename Fn> void run(TaskGroup &group, const Fn &fn) {
+    static_assert(std::is_trivially_copyable<Fn>::value,
+                  "tasks are stored by memcpy");
+    static_assert(sizeof(Fn) <= Task::capacity, "task captures too much");
+    Task task;
+    task.call = [](const void *storage) {
+      (*static_cast<const Fn *>(storage))();
+    };
+    task.group = &group;
+    std::memcpy(task.storage, &fn, sizeof(Fn));
+    push(task);
+  }
+  void wait(TaskGroup &group);
+
+  // Number of participants, including the waiting thread.
+  unsigned size() const { return static_cast<unsigned>(m_queues.size()); }
+  // Index of the calling participant, 0 for threads outside the pool.
+  unsigned current_index() const;
+
+  // Fraction of the wall time since the last reset_stats() that every
+  // participant spent executing tasks.
+  std::vector<double> utilization() const;
+  void reset_stats();
+
+private:
+  using clock = std::chrono::steady_clock;
+
+  struct Task {
+    static constexpr size_t capacity = 64;
+    void (*call)(const void *storage);
+    TaskGroup *group;
+    alignas(std::max_align_t) unsigned char storage[capacity];
+  };
+
+  // Grow-only ring buffer of tasks.
+  struct Queue {
+    std::mutex mutex;
+    std::vector<Task> ring;
+    size_t head = 0, count = 0;
+    std::atomic<long long> busy_ns{0};
+
+    void push_back(const Task &task);
+    Task pop_back();
+    Task pop_front();
+  };
+
+  void push(const Task &task);
+  bool pop(unsigned index, Task &task);
+  bool steal(unsigned index, Task &task);
+  void execute(unsigned index, Task &task);
+  void worker_loop(unsigned index);
+
+  std::vector<std::unique_ptr<Queue>> m_queues;
+  std::vector<std::thread> m_threads;
+  std::atomic<int> m_queued{0};
+  std::atomic<bool> m_stop{false};
+  std::atomic<int> m_sleeping{0}; // workers waiting for m_wake
+  std::mutex m_sleep_mutex;
+  std::condition_variable m_wake;
+  clock::time_point m_stats_start;
+};
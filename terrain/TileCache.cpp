@@ -0,0 +1,181 @@
+#include "TileCache.h"
+#include "CubeSphere.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+constexpr uint32_t CTileCache::npos;
+
+CTileCache::CTileCache(size_t budget) : m_budget(budget + 1) {
+  set_budget(budget);
+}
+
+size_t CTileCache::tile_bytes() {
+  return sizeof(Entry) + 2 * sizeof(Slot);
+}
+
+void CTileCache::set_budget(size_t bytes) {
+  if (bytes == m_budget)
+    return;
+  m_budget = bytes;
+  m_capacity = bytes / tile_bytes();
+  // Give the memory of a larger budget back.
+  std::vector<Entry>().swap(m_entries);
+  std::vector<Slot>(1024, Slot{npos, 0}).swap(m_index);
+  clear();
+}
+
+const Tile *CTileCache::find(NodeKey key, float radius) {
+  auto tile = touch(key, radius);
+  if (tile)
+    m_stats.hits++;
+  else
+    m_stats.misses++;
+  return tile;
+}
+
+const Tile *CTileCache::touch(NodeKey key, float radius) {
+  auto i = m_index[slot(key, radius, hash(key, radius))].entry;
+  if (i == npos)
+    return nullptr;
+  if (i != m_head) {
+    unlink(i);
+    push_front(i);
+  }
+  return &m_entries[i].tile;
+}
+
+bool CTileCache::contains(NodeKey key, float radius) const {
+  return m_index[slot(key, radius, hash(key, radius))].entry != npos;
+}
+
+void CTileCache::insert(NodeKey key, float radius, const Tile &tile) {
+  if (m_capacity == 0)
+    return;
+  if (m_size == m_capacity)
+    evict();
+  if (2 * (m_size + 1) > m_index.size())
+    grow_index();
+  uint32_t i;
+  if (m_free != npos) {
+    i = m_free;
+    m_free = m_entries[i].next;
+  } else {
+    i = static_cast<uint32_t>(m_entries.size());
+    m_entries.emplace_back();
+  }
+  auto &entry = m_entries[i];
+  entry.key = key;
+  entry.radius = radius;
+  entry.tile = tile;
+  auto h = hash(key, radius);
+  auto s = slot(key, radius, h);
+  assert(m_index[s].entry == npos);
+  m_index[s] = {i, h};
+  push_front(i);
+  m_size++;
+}
+
+Tile CTileCache::get(const QuadTree &qt, float radius) {
+  auto key = qt.key();
+  if (auto tile = find(key, radius))
+    return *tile;
+  auto q = project_to_sphere(static_cast<Face>(qt.m_face), qt.x(), qt.y(),
+                             qt.size(), radius);
+  Tile tile = {{q.p1, q.p2, q.p3, q.p4}};
+  insert(key, radius, tile);
+  return tile;
+}
+
+void CTileCache::clear() {
+  std::fill(m_index.begin(), m_index.end(), Slot{npos, 0});
+  m_entries.clear();
+  m_size = 0;
+  m_head = m_tail = m_free = npos;
+}
+
+uint32_t CTileCache::hash(NodeKey key, float radius) {
+  uint32_t bits;
+  std::memcpy(&bits, &radius, sizeof(bits));
+  uint64_t h = key.code ^ uint64_t(key.level) << 58 ^
+               uint64_t(key.face) << 52 ^ uint64_t(bits) << 17;
+  // splitmix64's finalizer.
+  h = (h ^ h >> 30) * 0xbf58476d1ce4e5b9ull;
+  h = (h ^ h >> 27) * 0x94d049bb133111ebull;
+  return static_cast<uint32_t>(h ^ h >> 31);
+}
+
+size_t CTileCache::slot(NodeKey key, float radius, uint32_t h) const {
+  size_t mask = m_index.size() - 1;
+  for (size_t s = h & mask;; s = (s + 1) & mask) {
+    auto i = m_index[s].entry;
+    if (i == npos || (m_index[s].hash == h && m_entries[i].key == key &&
+                      m_entries[i].radius == radius))
+      return s;
+  }
+}
+
+void CTileCache::unlink(uint32_t i) {
+  auto &entry = m_entries[i];
+  if (entry.prev != npos)
+    m_entries[entry.prev].next = entry.next;
+  else
+    m_head = entry.next;
+  if (entry.next != npos)
+    m_entries[entry.next].prev = entry.prev;
+  else
+    m_tail = entry.prev;
+}
+
+void CTileCache::push_front(uint32_t i) {
+  auto &entry = m_entries[i];
+  entry.prev = npos;
+  entry.next = m_head;
+  if (m_head != npos)
+    m_entries[m_head].prev = i;
+  else
+    m_tail = i;
+  m_head = i;
+}
+
+void CTileCache::erase_slot(size_t s) {
+  // Backward-shift deletion: pull later entries of the probe run into the
+  // hole unless that would move them before their home slot.
+  size_t mask = m_index.size() - 1;
+  m_index[s].entry = npos;
+  for (size_t j = (s + 1) & mask; m_index[j].entry != npos;
+       j = (j + 1) & mask) {
+    size_t home = m_index[j].hash & mask;
+    if (((j - home) & mask) >= ((j - s) & mask)) {
+      m_index[s] = m_index[j];
+      m_index[j].entry = npos;
+      s = j;
+    }
+  }
+}
+
+void CTileCache::evict() {
+  auto i = m_tail;
+  auto &entry = m_entries[i];
+  erase_slot(slot(entry.key, entry.radius, hash(entry.key, entry.radius)));
+  unlink(i);
+  entry.next = m_free;
+  m_free = i;
+  m_size--;
+  m_stats.evictions++;
+}
+
+void CTileCache::grow_index() {
+  std::vector<Slot> index(2 * m_index.size(), Slot{npos, 0});
+  std::swap(index, m_index);
+  size_t mask = m_index.size() - 1;
+  for (auto &old : index) {
+    if (old.entry == npos)
+      continue;
+    auto s = old.hash & mask;
+    while (m_index[s].entry != npos)
+      s = (s + 1) & mask;
+    m_index[s] = old;
+  }
+}
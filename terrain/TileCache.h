@@ -0,0 +1,90 @@
+#pragma once
+#include "QuadTree.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Geometry generated for one leaf: the corners project_to_sphere() returns.
+struct Tile {
+  glm::vec3 corners[4];
+};
+
+// Tiles by node identity and sphere radius, so that a leaf that stays in the
+// LOD from one frame to the next is not generated again. Holds at most
+// budget() bytes of tiles, including their share of the lookup table, and
+// evicts the least recently used ones beyond that. Lookups and insertions do
+// not allocate once the cache has grown to its working set.
+class CTileCache {
+public:
+  struct Stats {
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t evictions = 0;
+  };
+
+  explicit CTileCache(size_t budget = 16 << 20);
+
+  // Drops all tiles if the budget changes.
+  void set_budget(size_t bytes);
+  size_t budget() const { return m_budget; }
+  // Bytes held by the cached tiles.
+  size_t bytes() const { return m_size * tile_bytes(); }
+  // Memory per tile: its entry and the two index slots that keep the table
+  // at most half full.
+  static size_t tile_bytes();
+  size_t size() const { return m_size; }
+
+  // The cached tile, which becomes the most recently used one, or nullptr.
+  // Counts a hit or a miss. The pointer is valid until the next insert().
+  const Tile *find(NodeKey key, float radius);
+  // find() without counting, for lookups that do not stand for a leaf.
+  const Tile *touch(NodeKey key, float radius);
+  bool contains(NodeKey key, float radius) const;
+  // Adds a tile that is not cached yet, evicting as needed.
+  void insert(NodeKey key, float radius, const Tile &tile);
+  // find(), or project the node and insert() it.
+  Tile get(const QuadTree &qt, float radius);
+  void clear();
+
+  // Counters since the last reset_stats().
+  const Stats &stats() const { return m_stats; }
+  void reset_stats() { m_stats = Stats(); }
+
+private:
+  static constexpr uint32_t npos = ~0u;
+
+  struct Entry {
+    NodeKey key;
+    float radius;
+    uint32_t prev, next; // LRU list, most recent first; next links free ones
+    Tile tile;
+  };
+
+  // Keeps the hash next to the entry so that probing and deletion do not
+  // touch the entries of other keys.
+  struct Slot {
+    uint32_t entry; // npos if empty
+    uint32_t hash;
+  };
+
+  static uint32_t hash(NodeKey key, float radius);
+  // The index slot holding key, or the empty one where it would go.
+  size_t slot(NodeKey key, float radius, uint32_t h) const;
+  void unlink(uint32_t i);
+  void push_front(uint32_t i);
+  void erase_slot(size_t slot);
+  void evict();
+  void grow_index();
+
+  std::vector<Entry> m_entries;
+  std::vector<Slot> m_index;
+  size_t m_budget;
+  size_t m_capacity; // tiles that fit into the budget
+  size_t m_size = 0;
+  uint32_t m_head = npos, m_tail = npos;
+  uint32_t m_free = npos;
+  Stats m_stats;
+};
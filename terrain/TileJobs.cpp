@@ -0,0 +1,197 @@
+#include "TileJobs.h"
+#include "SphereProjection.h"
+
+#include <algorithm>
+
+namespace {
+// Jobs a worker takes per trip to the queue.
+const size_t batch_size = 16;
+
+bool by_key(const NodeKey &a, const NodeKey &b) { return a < b; }
+
+// Heap order: the lowest priority value on top.
+template <typename Job> bool less_urgent(const Job &a, const Job &b) {
+  return a.request.priority > b.request.priority;
+}
+} // namespace
+
+CTileJobs::CTileJobs(unsigned threads) {
+  threads = std::max(threads, 1u);
+  m_running.reserve(threads * batch_size);
+  for (unsigned i = 0; i < threads; i++)
+    m_threads.emplace_back([this] { worker_loop(); });
+}
+
+CTileJobs::~CTileJobs() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stop = true;
+  }
+  m_wake.notify_all();
+  for (auto &thread : m_threads)
+    thread.join();
+}
+
+void CTileJobs::schedule(const std::vector<Request> &requests) {
+  auto now = clock::now();
+  m_next.clear();
+  for (auto &request : requests)
+    m_next.push_back({request, now});
+  auto job_by_key = [](const Job &a, const Job &b) {
+    return by_key(a.request.key, b.request.key);
+  };
+  if (m_next.size() > max_queued) {
+    std::nth_element(m_next.begin(), m_next.begin() + max_queued, m_next.end(),
+                     [](const Job &a, const Job &b) {
+                       return a.request.priority < b.request.priority;
+                     });
+    m_next.resize(max_queued);
+  }
+  // Requests made while visiting the faces in order are sorted already.
+  if (!std::is_sorted(m_next.begin(), m_next.end(), job_by_key))
+    std::sort(m_next.begin(), m_next.end(), job_by_key);
+
+  // Both m_scheduled and m_ready are sorted by key too, so one merge pass
+  // carries the request times over and drops the tiles that are ready.
+  auto old = m_scheduled.begin();
+  auto ready = m_ready.begin();
+  size_t n = 0;
+  for (auto &job : m_next) {
+    auto key = job.request.key;
+    while (old != m_scheduled.end() && by_key(old->request.key, key))
+      ++old;
+    if (old != m_scheduled.end() && old->request.key == key)
+      job.requested = old->requested;
+    while (ready != m_ready.end() && by_key(ready->job.request.key, key))
+      ++ready;
+    if (ready != m_ready.end() && ready->job.request.key == key)
+      continue;
+    m_next[n++] = job;
+  }
+  m_next.resize(n);
+  m_scheduled = m_next;
+
+  std::make_heap(m_next.begin(), m_next.end(), less_urgent<Job>);
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::swap(m_queue, m_next);
+  }
+  m_wake.notify_all();
+}
+
+size_t CTileJobs::collect(CTileCache &cache, size_t budget) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::swap(m_done, m_incoming);
+  }
+  m_ready.insert(m_ready.end(), m_incoming.begin(), m_incoming.end());
+  m_incoming.clear();
+
+  size_t n = std::min(budget, m_ready.size());
+  if (n < m_ready.size())
+    std::nth_element(m_ready.begin(), m_ready.begin() + n, m_ready.end(),
+                     [](const Result &a, const Result &b) {
+                       return a.job.request.priority < b.job.request.priority;
+                     });
+  auto now = clock::now();
+  size_t inserted = 0;
+  for (size_t i = 0; i < n; i++) {
+    auto &result = m_ready[i];
+    auto &request = result.job.request;
+    // A tile can be generated twice if it was requested again before the
+    // first copy got collected.
+    if (cache.contains(request.key, request.radius))
+      continue;
+    cache.insert(request.key, request.radius, result.tile);
+    inserted++;
+    double ms = std::chrono::duration<double, std::milli>(
+                    now - result.job.requested)
+                    .count();
+    m_completed++;
+    m_latency_sum_ms += ms;
+    m_max_latency_ms = std::max(m_max_latency_ms, ms);
+  }
+  m_ready.erase(m_ready.begin(), m_ready.begin() + n);
+  std::sort(m_ready.begin(), m_ready.end(),
+            [](const Result &a, const Result &b) {
+              return by_key(a.job.request.key, b.job.request.key);
+            });
+  return inserted;
+}
+
+void CTileJobs::clear() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_queue.clear();
+    m_done.clear();
+  }
+  m_scheduled.clear();
+  m_ready.clear();
+}
+
+CTileJobs::Stats CTileJobs::stats() {
+  Stats stats;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats.queued = m_queue.size();
+    stats.ready = m_done.size();
+  }
+  stats.ready += m_ready.size();
+  stats.completed = m_completed;
+  if (m_completed)
+    stats.latency_ms = m_latency_sum_ms / m_completed;
+  stats.max_latency_ms = m_max_latency_ms;
+  return stats;
+}
+
+void CTileJobs::reset_stats() {
+  m_completed = 0;
+  m_latency_sum_ms = 0;
+  m_max_latency_ms = 0;
+}
+
+bool CTileJobs::running(NodeKey key) const {
+  return std::find(m_running.begin(), m_running.end(), key) !=
+         m_running.end();
+}
+
+void CTileJobs::worker_loop() {
+  Result results[batch_size];
+  std::unique_lock<std::mutex> lock(m_mutex);
+  for (;;) {
+    m_wake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+    if (m_stop)
+      return;
+    size_t n = 0;
+    while (n < batch_size && !m_queue.empty()) {
+      std::pop_heap(m_queue.begin(), m_queue.end(), less_urgent<Job>);
+      auto job = m_queue.back();
+      m_queue.pop_back();
+      // Another worker is still generating the copy an earlier schedule()
+      // queued.
+      if (running(job.request.key))
+        continue;
+      m_running.push_back(job.request.key);
+      results[n++].job = job;
+    }
+    lock.unlock();
+
+    for (size_t i = 0; i < n; i++) {
+      auto &request = results[i].job.request;
+      float x[4], y[4], z[4];
+      project_face_to_sphere(static_cast<Face>(request.key.face), request.u,
+                             request.v, 4, request.radius, x, y, z);
+      for (int c = 0; c < 4; c++)
+        results[i].tile.corners[c] = glm::vec3(x[c], y[c], z[c]);
+    }
+
+    lock.lock();
+    for (size_t i = 0; i < n; i++) {
+      m_done.push_back(results[i]);
+      auto it = std::find(m_running.begin(), m_running.end(),
+                          results[i].job.request.key);
+      *it = m_running.back();
+      m_running.pop_back();
+    }
+  }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "CubeSphere.h"
+#include "QuadTree.h"
+#include "TileCache.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Generates tiles on worker threads, so that the render thread never waits
+// for them. Once a frame the renderer hands the tiles it is missing to
+// schedule(); that list replaces whatever is still queued, so tiles that went
+// out of view during a fast move are never generated. Workers take the most
+// urgent request first. collect() moves finished tiles into the cache, at
+// most a given number per frame.
+//
+// schedule() and collect() belong to the render thread; they only hold the
+// lock to swap buffers, which do not allocate once they have grown to the
+// working set.
+class CTileJobs {
+public:
+  using clock = std::chrono::steady_clock;
+
+  struct Request {
+    NodeKey key;
+    float radius;
+    float priority; // lower is more urgent
+    float u[4], v[4]; // face-space corners, see project_face_to_sphere()
+  };
+
+  struct Stats {
+    size_t queued = 0;    // requests waiting for a worker
+    size_t ready = 0;     // generated, waiting for collect()
+    size_t completed = 0; // collected since reset_stats()
+    double latency_ms = 0; // mean time from first request to collect()
+    double max_latency_ms = 0;
+  };
+
+  explicit CTileJobs(unsigned threads = 2);
+  ~CTileJobs();
+  CTileJobs(const CTileJobs &) = delete;
+  CTileJobs &operator=(const CTileJobs &) = delete;
+
+  // Queues the max_queued most urgent of requests in place of the previous
+  // ones. A tile that was already requested keeps its original request time.
+  void schedule(const std::vector<Request> &requests);
+  // Inserts up to budget finished tiles into cache, the most urgent first,
+  // and returns how many it inserted.
+  size_t collect(CTileCache &cache, size_t budget);
+  // Drops queued requests and finished tiles, e.g. when the cache is cleared.
+  void clear();
+
+  Stats stats();
+  void reset_stats();
+
+  size_t max_queued = 8192;
+
+private:
+  struct Job {
+    Request request;
+    clock::time_point requested;
+  };
+  struct Result {
+    Job job;
+    Tile tile;
+  };
+
+  void worker_loop();
+  bool running(NodeKey key) const;
+
+  // Shared with the workers, under m_mutex.
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::vector<Job> m_queue; // heap, most urgent on top
+  std::vector<Result> m_done;
+  std::vector<NodeKey> m_running;
+  bool m_stop = false;
+
+  // Render thread only.
+  std::vector<Job> m_scheduled; // the last schedule(), sorted by key
+  std::vector<Job> m_next;
+  std::vector<Result> m_ready; // collected from m_done, sorted by key
+  std::vector<Result> m_incoming;
+  size_t m_completed = 0;
+  double m_latency_sum_ms = 0;
+  double m_max_latency_ms = 0;
+
+  std::vector<std::thread> m_threads;
+};
@@ -0,0 +1,118 @@
+#include "TraceRecorder.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+// Small stable thread ids, in the order threads first record something.
+unsigned trace_thread_id() {
+  static std::atomic<unsigned> next{0};
+  thread_local unsigned id = next.fetch_add(1);
+  return id;
+}
+} // namespace
+
+CTraceRecorder &CTraceRecorder::instance() {
+  static CTraceRecorder recorder;
+  return recorder;
+}
+
+CTraceRecorder::~CTraceRecorder() {
+  stop();
+  if (m_writer.joinable())
+    m_writer.join();
+}
+
+void CTraceRecorder::start(const std::string &path, size_t capacity) {
+  stop();
+  if (m_writer.joinable())
+    m_writer.join();
+  m_path = path;
+  m_events.assign(capacity, Event());
+  m_count = 0;
+  m_origin = clock::now();
+  m_recording = true;
+}
+
+void CTraceRecorder::stop() {
+  if (!m_recording.exchange(false))
+    return;
+  if (m_writer.joinable())
+    m_writer.join();
+  size_t count = std::min(m_count.load(), m_events.size());
+  m_writer = std::thread(
+      [](std::string path, std::vector<Event> events, size_t count) {
+        write(path, events, count);
+      },
+      m_path, std::move(m_events), count);
+  m_events = std::vector<Event>();
+}
+
+size_t CTraceRecorder::events() const {
+  return std::min(m_count.load(), m_events.size());
+}
+
+size_t CTraceRecorder::dropped() const {
+  size_t count = m_count.load();
+  return count > m_events.size() ? count - m_events.size() : 0;
+}
+
+void CTraceRecorder::push(const Event &event) {
+  size_t i = m_count.fetch_add(1, std::memory_order_relaxed);
+  if (i < m_events.size())
+    m_events[i] = event;
+}
+
+void CTraceRecorder::span(const char *name, clock::time_point start,
+                          clock::time_point end, int arg) {
+  using std::chrono::nanoseconds;
+  Event event;
+  event.name = name;
+  event.ts_ns =
+      std::chrono::duration_cast<nanoseconds>(start - m_origin).count();
+  event.dur_ns = std::chrono::duration_cast<nanoseconds>(end - start).count();
+  event.value = 0;
+  event.arg = arg;
+  event.tid = trace_thread_id();
+  event.phase = 'X';
+  push(event);
+}
+
+void CTraceRecorder::counter(const char *name, double value) {
+  Event event;
+  event.name = name;
+  event.ts_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    clock::now() - m_origin)
+                    .count();
+  event.dur_ns = 0;
+  event.value = value;
+  event.arg = -1;
+  event.tid = trace_thread_id();
+  event.phase = 'C';
+  push(event);
+}
+
+void CTraceRecorder::write(const std::string &path,
+                           const std::vector<Event> &events, size_t count) {
+  FILE *out = fopen(path.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "cannot open %s\n", path.c_str());
+    return;
+  }
+  fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  for (size_t i = 0; i < count; i++) {
+    auto &e = events[i];
+    fprintf(out, "{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, ", e.name,
+            e.phase, 1e-3 * e.ts_ns);
+    if (e.phase == 'X')
+      fprintf(out, "\"dur\": %.3f, ", 1e-3 * e.dur_ns);
+    fprintf(out, "\"pid\": 1, \"tid\": %u", e.tid);
+    if (e.phase == 'C')
+      fprintf(out, ", \"args\": {\"%s\": %.17g}", e.name, e.value);
+    else if (e.arg >= 0)
+      fprintf(out, ", \"args\": {\"face\": %d}", e.arg);
+    fprintf(out, "}%s\n", i + 1 < count ? "," : "");
+  }
+  fprintf(out, "]}\n");
+  fclose(out);
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Records spans and counters in the Chrome trace-event format, for
+// chrome://tracing or Perfetto. Events go into a buffer sized by start(), so
+// recording neither allocates nor locks; events past its capacity are
+// dropped. stop() hands the buffer to a background thread that writes the
+// JSON file. start() and stop() are meant to be called between frames, while
+// no instrumented code runs on other threads.
+class CTraceRecorder {
+public:
+  using clock = std::chrono::steady_clock;
+
+  // Records the enclosing block as a span while recording.
+  class Scope {
+  public:
+    Scope(const char *name, int arg = -1)
+        : m_name(name), m_arg(arg), m_start(clock::now()) {}
+    ~Scope() {
+      auto &trace = instance();
+      if (trace.recording())
+        trace.span(m_name, m_start, clock::now(), m_arg);
+    }
+
+  private:
+    const char *m_name;
+    int m_arg;
+    clock::time_point m_start;
+  };
+
+  static CTraceRecorder &instance();
+  ~CTraceRecorder();
+
+  // Starts a recording of at most capacity events that stop() writes to path.
+  void start(const std::string &path, size_t capacity = 1 << 18);
+  void stop();
+  bool recording() const { return m_recording.load(std::memory_order_relaxed); }
+  const std::string &path() const { return m_path; }
+  // Events recorded and dropped since start().
+  size_t events() const;
+  size_t dropped() const;
+
+  // Names must be string literals or otherwise outlive the recording. A
+  // non-negative arg is written as args.face.
+  void span(const char *name, clock::time_point start, clock::time_point end,
+            int arg = -1);
+  void counter(const char *name, double value);
+
+private:
+  struct Event {
+    const char *name;
+    long long ts_ns, dur_ns;
+    double value;
+    int arg;
+    unsigned tid;
+    char phase;
+  };
+
+  CTraceRecorder() = default;
+  void push(const Event &event);
+  static void write(const std::string &path, const std::vector<Event> &events,
+                    size_t count);
+
+  std::atomic<bool> m_recording{false};
+  std::vector<Event> m_events;
+  std::atomic<size_t> m_count{0};
+  std::string m_path;
+  clock::time_point m_origin;
+  std::thread m_writer;
+};
@@ -0,0 +1,846 @@
+// LOD micro-benchmarks. Every stage of the LOD pipeline is run headless over
+// a grid of DEPTH and K values while the focus point orbits the way update()
+// in terrain.cpp moves it. Results are written as JSON to the file given as
+// the first argument, or to stdout.
+//
+// usage: terrain_bench [output.json] [frames]
+
+#include "Camera.h"
+#include "CubeSphere.h"
+#include "LinearQuadTree.h"
+#include "LodPipeline.h"
+#include "MeshBuilder.h"
+#include "MultiViewLod.h"
+#include "Planet.h"
+#include "SphereProjection.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static std::atomic<size_t> g_allocations{0};
+
+void *operator new(size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+namespace {
+using bench_clock = std::chrono::steady_clock;
+
+struct Result {
+  std::string name;
+  int depth;
+  float k;
+  int frames;
+  double ns;
+  size_t items;
+  size_t allocations;
+  long long cache_misses; // -1 if not available
+};
+
+struct Leaf {
+  double x, y, size;
+};
+
+struct LeafCollector : ITreeVisitorCallback {
+  std::vector<Leaf> *leaves = nullptr;
+  void OnLeaf(QuadTree *qt, bool is_last, int level) override {
+    leaves->push_back({qt->x(), qt->y(), qt->size()});
+  }
+};
+
+struct LeafCounter : ITreeVisitorCallback {
+  size_t leaves = 0;
+  void OnLeaf(QuadTree *qt, bool is_last, int level) override { leaves++; }
+};
+
+struct StaticLeafCounter : TreeVisitor {
+  size_t leaves = 0;
+  void OnLeaf(QuadTree *qt, bool is_last, int level) { leaves++; }
+};
+
+struct KeyCollector : TreeVisitor {
+  std::vector<NodeKey> *keys = nullptr;
+  void OnLeaf(QuadTree *qt, bool is_last, int level) {
+    keys->push_back(qt->key());
+  }
+};
+
+// Last-level cache misses of this thread, from the hardware counters where
+// the kernel lets us read them.
+class CacheMissCounter {
+public:
+  CacheMissCounter() {
+#ifdef __linux__
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    m_fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+  }
+  ~CacheMissCounter() {
+#ifdef __linux__
+    if (m_fd >= 0)
+      close(m_fd);
+#endif
+  }
+  CacheMissCounter(const CacheMissCounter &) = delete;
+  CacheMissCounter &operator=(const CacheMissCounter &) = delete;
+
+  // Running total, or -1 without a counter.
+  long long read() const {
+    long long value = -1;
+#ifdef __linux__
+    if (m_fd < 0 || ::read(m_fd, &value, sizeof(value)) != sizeof(value))
+      return -1;
+#endif
+    return value;
+  }
+
+private:
+  int m_fd = -1;
+};
+
+volatile float g_sink;
+
+// Same path as update() at 60 frames per second with the default speed.
+glm::vec2 orbit_point(int frame) {
+  float t = 0.1f * 0.001f * (1000.f / 60) * frame;
+  return glm::vec2(3 * glm::cos(t), 3 * glm::sin(t));
+}
+
+class Bench {
+public:
+  Bench(int frames) : m_frames(frames), m_planet(m_workers) {
+    // Looking at the planet from close by, with about half of it in view.
+    CCamera camera(glm::vec3(0, 0, -3), glm::vec3(0, 1, 0), glm::radians(90.f),
+                   0);
+    m_frustum = camera.getFrustumPlanes();
+    m_eye = camera.getPosition();
+  }
+
+  // Every failed check is reported on stderr; returns their number.
+  int run_checks() {
+    for (int depth = 0; depth <= 32; depth += 4)
+      for (float k = 1.f; k <= 3.f; k += 0.5f) {
+        check_split_parallel(depth, k);
+        check_split_incremental_culled(depth, k);
+        check_traversals(depth, k);
+        check_visit_implicit(depth, k);
+        check_sphere_kernel(depth, k);
+      }
+    check_multi_view(16, 1000, 16, 1.5f);
+    check_multi_view(256, 100, 16, 1.5f);
+    return m_failures;
+  }
+
+  void run_grid() {
+    const char *modes[] = {"split", "split_incremental", "split_parallel",
+                           "split_breadth_first"};
+    for (int depth = 0; depth <= 32; depth += 4) {
+      for (float k = 1.f; k <= 3.f; k += 0.5f) {
+        for (int mode = 0; mode < 4; mode++)
+          bench_split(modes[mode], static_cast<LodMode>(mode), depth, k);
+        bench_split_culled("split_frustum", LodMode::rebuild, true, false, depth,
+                           k);
+        bench_split_culled("split_horizon", LodMode::rebuild, false, true, depth,
+                           k);
+        bench_split_culled("split_incremental_frustum", LodMode::incremental,
+                           true, false, depth, k);
+        bench_split_screen_space(depth, k);
+        bench_split_budgeted(depth, k);
+        bench_leaf_deltas(depth, k);
+        bench_hysteresis(depth, k);
+        bench_linear_split(depth, k);
+        bench_linear_neighbours(depth, k);
+        bench_visit(depth, k);
+        bench_visit_template(depth, k);
+        bench_visit_iterative(depth, k);
+        bench_visit_breadth_first(depth, k);
+        bench_rebuild_and_visit(depth, k);
+        bench_visit_implicit(depth, k);
+        bench_sphere_vertices(depth, k);
+        bench_sphere_kernel(depth, k);
+        bench_mesh_build(depth, k);
+        bench_mesh_build_orbit("mesh_build_orbit", nullptr, nullptr, depth, k);
+        bench_mesh_build_orbit("mesh_build_orbit_cached", &m_tiles, nullptr,
+                               depth, k);
+        bench_mesh_build_orbit("mesh_build_orbit_async", &m_tiles, &m_tile_jobs,
+                               depth, k);
+        bench_lod_pipeline(depth, k);
+      }
+    }
+    bench_face_projection();
+    // The two faces facing the focus point split all the way down: ~0.5M
+    // leaves, far more than the caches hold.
+    bench_visit(12, 1e9f);
+    bench_visit_template(12, 1e9f);
+    bench_visit_iterative(12, 1e9f);
+    bench_visit_breadth_first(12, 1e9f);
+    bench_rebuild_and_visit(12, 1e9f);
+    bench_visit_implicit(12, 1e9f);
+    bench_split("split", LodMode::rebuild, 12, 1e9f);
+    bench_split_budgeted(12, 1e9f);
+    bench_multi_view("multi_view_16", 16, 1000, 16, 1.5f);
+    bench_multi_view_separate("multi_view_separate_16", 16, 1000, 16, 1.5f);
+    bench_multi_view("multi_view_256", 256, 1000, 16, 1.5f);
+    bench_multi_view_separate("multi_view_separate_256", 256, 1000, 16, 1.5f);
+    bench_multi_view("multi_view_256_clustered", 256, 100, 16, 1.5f);
+    bench_multi_view_separate("multi_view_separate_256_clustered", 256, 100,
+                              16, 1.5f);
+  }
+
+  void write(FILE *out) const {
+    fprintf(out, "{\n  \"frames\": %d,\n  \"threads\": %u,\n", m_frames,
+            m_workers.size());
+    fprintf(out, "  \"benchmarks\": [\n");
+    for (size_t i = 0; i < m_results.size(); i++) {
+      auto &r = m_results[i];
+      fprintf(out, "    {\"name\": \"%s\", ", r.name.c_str());
+      if (r.depth >= 0)
+        fprintf(out, "\"depth\": %d, \"k\": %.2f, ", r.depth, r.k);
+      else
+        fprintf(out, "\"depth\": null, \"k\": null, ");
+      if (r.cache_misses >= 0)
+        fprintf(out, "\"cache_misses_per_node\": %.3f, ",
+                r.items ? double(r.cache_misses) / r.items : 0.0);
+      else
+        fprintf(out, "\"cache_misses_per_node\": null, ");
+      fprintf(out,
+              "\"ns_per_node\": %.3f, \"nodes_per_frame\": %.1f, "
+              "\"items_per_sec\": %.0f, \"allocs_per_frame\": %.2f}%s\n",
+              r.items ? r.ns / r.items : 0.0, double(r.items) / r.frames,
+              r.ns > 0 ? 1e9 * r.items / r.ns : 0.0,
+              double(r.allocations) / r.frames,
+              i + 1 < m_results.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+  }
+
+private:
+  LodSettings settings(LodMode mode, int depth, float k, int frame) const {
+    LodSettings s;
+    s.depth = depth;
+    s.k = k;
+    s.mode = mode;
+    s.point = orbit_point(frame);
+    return s;
+  }
+
+  // Times fn(frame) over all frames after one warm-up frame; fn returns the
+  // number of items (nodes, leaves, vertices) it processed.
+  template <typename Fn> void measure(Result r, Fn fn) {
+    fn(-1);
+    size_t items = 0;
+    size_t allocations = g_allocations.load();
+    long long misses = m_cache_misses.read();
+    auto start = bench_clock::now();
+    for (int frame = 0; frame < m_frames; frame++)
+      items += fn(frame);
+    auto ns = std::chrono::duration<double, std::nano>(bench_clock::now() -
+                                                       start)
+                  .count();
+    // Counts the calling thread only, which misses the pool workers.
+    r.cache_misses = misses >= 0 ? m_cache_misses.read() - misses : -1;
+    r.frames = m_frames;
+    r.ns = ns;
+    r.items = items;
+    r.allocations = g_allocations.load() - allocations;
+    m_results.push_back(r);
+  }
+
+  void fail(const char *check, int depth, float k, const char *what) {
+    fprintf(stderr, "check %s failed at depth %d, k %.2f: %s\n", check, depth,
+            k, what);
+    m_failures++;
+  }
+
+  // The leaves of m_planet's last update(), sorted.
+  void planet_leaves(std::vector<NodeKey> &out) {
+    out.clear();
+    KeyCollector collector;
+    collector.keys = &out;
+    for (int i = 0; i < 6; i++)
+      m_planet.visit(static_cast<Face>(i), collector);
+    std::sort(out.begin(), out.end());
+  }
+
+  // Checks run at a few points spread over a third of the orbit.
+  void check_split_parallel(int depth, float k) {
+    std::vector<NodeKey> expected, leaves;
+    for (int frame = 0; frame < 1600; frame += 400) {
+      m_planet.update(settings(LodMode::rebuild, depth, k, frame));
+      planet_leaves(expected);
+      m_planet.update(settings(LodMode::parallel, depth, k, frame));
+      planet_leaves(leaves);
+      if (leaves != expected) {
+        fail("split_parallel", depth, k, "leaves differ from split");
+        return;
+      }
+    }
+  }
+
+  // Incremental updates with culling, while the camera turns and culling is
+  // switched on and off, against split(): the visible leaves must be the
+  // same.
+  void check_split_incremental_culled(int depth, float k) {
+    std::vector<NodeKey> expected, leaves;
+    for (int frame = 0; frame < 1600; frame += 40) {
+      CCamera camera(glm::vec3(0, 0, -3), glm::vec3(0, 1, 0),
+                     glm::radians(90.f) + 0.001f * frame, 0);
+      auto s = settings(LodMode::rebuild, depth, k, frame);
+      s.frustum_cull = frame % 400 < 300;
+      s.frustum = camera.getFrustumPlanes();
+      s.horizon_cull = s.frustum_cull;
+      s.eye = camera.getPosition();
+      m_planet.update(s);
+      planet_leaves(expected);
+      s.mode = LodMode::incremental;
+      m_planet.update(s);
+      planet_leaves(leaves);
+      if (leaves != expected) {
+        fail("split_incremental_culled", depth, k,
+             "visible leaves differ from split");
+        return;
+      }
+    }
+  }
+
+  // The iterative and level-order traversals against the recursive visit()
+  // of split()'s tree; the iterative one must keep the order, too.
+  void check_traversals(int depth, float k) {
+    std::vector<NodeKey> expected, leaves;
+    KeyCollector collector;
+    collector.keys = &leaves;
+    LevelOrderScratch scratch;
+    for (int frame = 0; frame < 1600; frame += 400) {
+      m_planet.update(settings(LodMode::rebuild, depth, k, frame));
+      planet_leaves(expected);
+      leaves.clear();
+      for (int i = 0; i < 6; i++)
+        m_planet.face(static_cast<Face>(i)).visit_iterative(collector);
+      std::vector<NodeKey> recursive;
+      for (int i = 0; i < 6; i++) {
+        KeyCollector in_order;
+        in_order.keys = &recursive;
+        m_planet.face(static_cast<Face>(i)).visit(in_order);
+      }
+      if (leaves != recursive) {
+        fail("visit_iterative", depth, k, "leaves or order differ from visit");
+        return;
+      }
+      m_planet.update(settings(LodMode::breadth_first, depth, k, frame));
+      leaves.clear();
+      for (int i = 0; i < 6; i++)
+        m_planet.face(static_cast<Face>(i)).visit_breadth_first(collector,
+                                                                scratch);
+      std::sort(leaves.begin(), leaves.end());
+      if (leaves != expected) {
+        fail("visit_breadth_first", depth, k, "leaves differ from split");
+        return;
+      }
+    }
+  }
+
+  // The leaves enumerated without a tree against split().
+  void check_visit_implicit(int depth, float k) {
+    std::vector<NodeKey> expected, leaves;
+    for (int frame = 0; frame < 1600; frame += 400) {
+      m_planet.update(settings(LodMode::rebuild, depth, k, frame));
+      planet_leaves(expected);
+      m_planet.update(settings(LodMode::implicit, depth, k, frame));
+      planet_leaves(leaves);
+      if (leaves != expected) {
+        fail("visit_implicit", depth, k, "leaves differ from split");
+        return;
+      }
+    }
+  }
+
+  // Every SIMD path of project_face_to_sphere() against the scalar one on
+  // the leaf corners along the orbit, bit for bit.
+  void check_sphere_kernel(int depth, float k) {
+    std::vector<float> u, v, expected[3], result[3];
+    for (int frame = 0; frame < 1600; frame += 400) {
+      m_planet.update(settings(LodMode::rebuild, depth, k, frame));
+      for (int f = 0; f < 6; f++) {
+        std::vector<Leaf> leaves;
+        LeafCollector collector;
+        collector.leaves = &leaves;
+        m_planet.face(static_cast<Face>(f)).visit(&collector, 0, 0, 0);
+        u.clear();
+        v.clear();
+        for (auto &leaf : leaves) {
+          for (int corner = 0; corner < 4; corner++) {
+            u.push_back(float(leaf.x + (corner >> 1 ? 0.5 : -0.5) * leaf.size));
+            v.push_back(float(leaf.y + (corner & 1 ? 0.5 : -0.5) * leaf.size));
+          }
+        }
+        project(static_cast<Face>(f), u, v, SimdPath::scalar, expected);
+        for (int path = 1; path < 3; path++) {
+          auto simd = static_cast<SimdPath>(path);
+          if (!simd_path_supported(simd))
+            continue;
+          project(static_cast<Face>(f), u, v, simd, result);
+          for (int c = 0; c < 3; c++) {
+            if (result[c].empty() ||
+                !std::memcmp(result[c].data(), expected[c].data(),
+                             result[c].size() * sizeof(float)))
+              continue;
+            std::string check = "sphere_kernel_";
+            check += simd_path_name(simd);
+            fail(check.c_str(), depth, k, "differs from scalar");
+            return;
+          }
+        }
+      }
+    }
+  }
+
+  void project(Face f, const std::vector<float> &u, const std::vector<float> &v,
+               SimdPath path, std::vector<float> (&xyz)[3]) {
+    for (auto &c : xyz)
+      c.resize(u.size());
+    project_face_to_sphere(f, u.data(), v.data(), u.size(), m_planet.radius(),
+                           xyz[0].data(), xyz[1].data(), xyz[2].data(), path);
+  }
+
+  // CMultiViewLod on every SIMD path against one split() per observer.
+  void check_multi_view(int observers, int spread, int depth, float k) {
+    std::vector<NodeKey> expected, leaves;
+    auto path = m_multi_view.simd_path;
+    for (int frame = 0; frame < 1600; frame += 400) {
+      observer_points(observers, spread, frame);
+      auto s = settings(LodMode::rebuild, depth, k, frame);
+      for (int p = 0; p < 3; p++) {
+        m_multi_view.simd_path = static_cast<SimdPath>(p);
+        if (!simd_path_supported(m_multi_view.simd_path))
+          continue;
+        m_multi_view.update(s, m_observers.data(), m_observers.size());
+        for (int i = 0; i < observers; i++) {
+          s.point = m_observers[i];
+          m_planet.update(s);
+          planet_leaves(expected);
+          m_multi_view.leaves(i, leaves);
+          if (leaves != expected) {
+            std::string check = "multi_view_";
+            check += simd_path_name(m_multi_view.simd_path);
+            fail(check.c_str(), depth, k, "leaves differ from split");
+            m_multi_view.simd_path = path;
+            return;
+          }
+        }
+      }
+    }
+    m_multi_view.simd_path = path;
+  }
+
+  void bench_split(const char *name, LodMode mode, int depth, float k) {
+    measure({name, depth, k}, [&](int frame) {
+      m_planet.update(settings(mode, depth, k, frame));
+      return m_planet.stats().nodes;
+    });
+  }
+
+  void bench_split_culled(const char *name, LodMode mode, bool frustum,
+                          bool horizon, int depth, float k) {
+    measure({name, depth, k}, [&](int frame) {
+      auto s = settings(mode, depth, k, frame);
+      s.frustum_cull = frustum;
+      s.frustum = m_frustum;
+      s.horizon_cull = horizon;
+      s.eye = m_eye;
+      m_planet.update(s);
+      return m_planet.stats().nodes;
+    });
+  }
+
+  // Ignores k; one pixel of error at the viewer's default resolution.
+  void bench_split_screen_space(int depth, float k) {
+    measure({"split_screen_space", depth, k}, [&](int frame) {
+      auto s = settings(LodMode::rebuild, depth, k, frame);
+      s.policy = SplitPolicy::screen_space;
+      s.pixel_error = 1;
+      s.eye = m_eye;
+      m_planet.update(s);
+      return m_planet.stats().nodes;
+    });
+  }
+
+  // At most 64k nodes: split's work plus a heap while the trees fit, and a
+  // flat cost once they would not.
+  void bench_split_budgeted(int depth, float k) {
+    measure({"split_budgeted", depth, k}, [&](int frame) {
+      auto s = settings(LodMode::budgeted, depth, k, frame);
+      s.node_budget = 1 << 16;
+      m_planet.update(s);
+      return m_planet.stats().nodes;
+    });
+  }
+
+  // split_incremental plus the added and removed leaves.
+  void bench_leaf_deltas(int depth, float k) {
+    measure({"split_incremental_deltas", depth, k}, [&](int frame) {
+      auto s = settings(LodMode::incremental, depth, k, frame);
+      s.leaf_deltas = true;
+      m_planet.update(s);
+      return m_planet.stats().nodes;
+    });
+  }
+
+  // split_incremental with a 25% merge band and a 10-frame minimum lifetime.
+  void bench_hysteresis(int depth, float k) {
+    measure({"split_incremental_hysteresis", depth, k}, [&](int frame) {
+      auto s = settings(LodMode::incremental, depth, k, frame);
+      s.merge_band = 0.25f;
+      s.min_lifetime = 10;
+      m_planet.update(s);
+      return m_planet.stats().nodes;
+    });
+  }
+
+  // split's trees built into one CLinearQuadTree.
+  void bench_linear_split(int depth, float k) {
+    measure({"linear_split", depth, k}, [&](int frame) {
+      build_linear(settings(LodMode::rebuild, depth, k, frame));
+      return m_linear.size();
+    });
+  }
+
+  // All four edge neighbours of every leaf.
+  void bench_linear_neighbours(int depth, float k) {
+    build_linear(settings(LodMode::rebuild, depth, k, 0));
+    measure({"linear_neighbours", depth, k}, [&](int) {
+      size_t found = 0, queries = 0;
+      m_linear.for_each_leaf([&](const CLinearQuadTree::Node &leaf) {
+        CLinearQuadTree::Node neighbour;
+        for (int d = 0; d < 4; d++)
+          found += m_linear.neighbour_leaf(
+              leaf.key, static_cast<CLinearQuadTree::Direction>(d),
+              &neighbour);
+        queries += 4;
+      });
+      g_sink = static_cast<float>(found);
+      return queries;
+    });
+  }
+
+  void build_linear(const LodSettings &s) {
+    QuadTreeGeometry geometry;
+    geometry.depth = s.depth;
+    geometry.size = s.size;
+    m_linear.clear();
+    m_linear.set_geometry(geometry);
+    for (int i = 0; i < 6; i++) {
+      auto p = face_focus_point(static_cast<Face>(i), s.point, 0.5f * s.size);
+      m_linear.split(i, DistanceCriterion(p.x, p.y, s.k));
+    }
+  }
+
+  void bench_visit(int depth, float k) {
+    m_planet.update(settings(LodMode::rebuild, depth, k, 0));
+    measure({"visit", depth, k}, [&](int) {
+      LeafCounter counter;
+      for (int i = 0; i < 6; i++)
+        m_planet.face(static_cast<Face>(i)).visit(&counter, 0, 0, 0);
+      return counter.leaves;
+    });
+  }
+
+  void bench_visit_template(int depth, float k) {
+    m_planet.update(settings(LodMode::rebuild, depth, k, 0));
+    measure({"visit_template", depth, k}, [&](int) {
+      StaticLeafCounter counter;
+      for (int i = 0; i < 6; i++)
+        m_planet.face(static_cast<Face>(i)).visit(counter);
+      return counter.leaves;
+    });
+  }
+
+  // visit_template() without recursion, over the same depth-first tree.
+  void bench_visit_iterative(int depth, float k) {
+    m_planet.update(settings(LodMode::rebuild, depth, k, 0));
+    measure({"visit_iterative", depth, k}, [&](int) {
+      StaticLeafCounter counter;
+      for (int i = 0; i < 6; i++)
+        m_planet.face(static_cast<Face>(i)).visit_iterative(counter);
+      return counter.leaves;
+    });
+  }
+
+  // Level order over a tree built level by level, so that the nodes are read
+  // in the order they were allocated.
+  void bench_visit_breadth_first(int depth, float k) {
+    m_planet.update(settings(LodMode::breadth_first, depth, k, 0));
+    LevelOrderScratch scratch;
+    measure({"visit_breadth_first", depth, k}, [&](int) {
+      StaticLeafCounter counter;
+      for (int i = 0; i < 6; i++)
+        m_planet.face(static_cast<Face>(i)).visit_breadth_first(counter,
+                                                                 scratch);
+      return counter.leaves;
+    });
+  }
+
+  // What a frame of the viewer needs from the LOD: split, then all leaves.
+  void bench_rebuild_and_visit(int depth, float k) {
+    measure({"rebuild_and_visit", depth, k}, [&](int frame) {
+      m_planet.update(settings(LodMode::rebuild, depth, k, frame));
+      return count_leaves();
+    });
+  }
+
+  // The same leaves without a tree.
+  void bench_visit_implicit(int depth, float k) {
+    measure({"visit_implicit", depth, k}, [&](int frame) {
+      m_planet.update(settings(LodMode::implicit, depth, k, frame));
+      return count_leaves();
+    });
+  }
+
+  size_t count_leaves() {
+    StaticLeafCounter counter;
+    for (int i = 0; i < 6; i++)
+      m_planet.visit(static_cast<Face>(i), counter);
+    return counter.leaves;
+  }
+
+  void bench_sphere_vertices(int depth, float k) {
+    m_planet.update(settings(LodMode::rebuild, depth, k, 0));
+    std::vector<Leaf> leaves[6];
+    for (int i = 0; i < 6; i++) {
+      LeafCollector collector;
+      collector.leaves = &leaves[i];
+      m_planet.face(static_cast<Face>(i)).visit(&collector, 0, 0, 0);
+    }
+    float radius = m_planet.radius();
+    measure({"sphere_vertices", depth, k}, [&](int) {
+      size_t vertices = 0;
+      float sum = 0;
+      for (int i = 0; i < 6; i++) {
+        for (auto &leaf : leaves[i]) {
+          auto q = project_to_sphere(static_cast<Face>(i), leaf.x, leaf.y,
+                                     leaf.size, radius);
+          sum += q.p1.x + q.p2.y + q.p3.z + q.p4.x;
+        }
+        vertices += 4 * leaves[i].size();
+      }
+      g_sink = sum;
+      return vertices;
+    });
+  }
+
+  // Same corners as sphere_vertices, projected in one batch per face.
+  void bench_sphere_kernel(int depth, float k) {
+    m_planet.update(settings(LodMode::rebuild, depth, k, 0));
+    CMeshBuilder builder;
+    MeshEmitter emitter(&builder);
+    builder.begin(m_planet.radius());
+    for (int i = 0; i < 6; i++) {
+      builder.set_face(static_cast<Face>(i));
+      m_planet.face(static_cast<Face>(i)).visit(emitter);
+    }
+    for (int path = 0; path < 3; path++) {
+      if (!simd_path_supported(static_cast<SimdPath>(path)))
+        continue;
+      builder.simd_path = static_cast<SimdPath>(path);
+      std::string name = "sphere_kernel_";
+      name += simd_path_name(builder.simd_path);
+      measure({name, depth, k}, [&](int) {
+        builder.end();
+        return builder.vertex_count();
+      });
+    }
+  }
+
+  void bench_mesh_build(int depth, float k) {
+    m_planet.update(settings(LodMode::rebuild, depth, k, 0));
+    CMeshBuilder builder;
+    MeshEmitter emitter(&builder);
+    measure({"mesh_build", depth, k}, [&](int) {
+      builder.begin(m_planet.radius());
+      for (int i = 0; i < 6; i++) {
+        builder.set_face(static_cast<Face>(i));
+        m_planet.face(static_cast<Face>(i)).visit(emitter);
+      }
+      builder.end();
+      return builder.vertex_count();
+    });
+  }
+
+  // mesh_build while the focus point moves, with the LOD update excluded.
+  // With jobs, the tiles are generated concurrently and drawn a few frames
+  // late; with cores to spare the time is that of the calling thread alone.
+  void bench_mesh_build_orbit(const char *name, CTileCache *cache,
+                              CTileJobs *jobs, int depth, float k) {
+    auto &builder = m_orbit_builder;
+    builder.cache = cache;
+    builder.jobs = jobs;
+    MeshEmitter emitter(&builder);
+    if (cache)
+      cache->clear();
+    if (jobs)
+      jobs->clear();
+    bench_clock::duration lod{};
+    measure({name, depth, k}, [&](int frame) {
+      auto start = bench_clock::now();
+      m_planet.update(settings(LodMode::incremental, depth, k, frame));
+      if (frame >= 0)
+        lod += bench_clock::now() - start;
+      if (jobs)
+        jobs->collect(*cache, 2048);
+      builder.begin(m_planet.radius());
+      for (int i = 0; i < 6; i++) {
+        auto face = static_cast<Face>(i);
+        builder.set_face(face);
+        builder.set_focus(face, m_planet.focus_point(face));
+        m_planet.visit(face, emitter);
+      }
+      builder.end();
+      if (jobs)
+        jobs->schedule(builder.requests());
+      return builder.vertex_count();
+    });
+    m_results.back().ns -=
+        std::chrono::duration<double, std::nano>(lod).count();
+  }
+
+  // The render thread's share of a pipelined frame: submitting the input and
+  // picking up the newest meshes. Each frame then waits for its own output,
+  // as if the LOD thread kept up with the display; that wait is not timed.
+  void bench_lod_pipeline(int depth, float k) {
+    auto &pipeline = m_pipeline;
+    pipeline.start();
+    bench_clock::duration wait{};
+    measure({"lod_pipeline_render", depth, k}, [&](int frame) {
+      auto id = static_cast<uint64_t>(frame + 1);
+      auto &input = pipeline.input();
+      input.settings = settings(LodMode::incremental, depth, k, frame);
+      input.frame = id;
+      pipeline.submit();
+      auto output = pipeline.output();
+      size_t vertices = output ? output->builder.vertex_count() : 0;
+      auto start = bench_clock::now();
+      while (!(output = pipeline.output()) || output->frame != id)
+        std::this_thread::yield();
+      if (frame >= 0)
+        wait += bench_clock::now() - start;
+      return vertices;
+    });
+    m_results.back().ns -=
+        std::chrono::duration<double, std::nano>(wait).count();
+    // Hands m_planet back to the other benchmarks.
+    pipeline.stop();
+  }
+
+  // Observers spaced evenly along the orbit over spread frames: 1000 is
+  // about a quarter of it. Nodes are counted per observer, as the separate
+  // rebuilds below build them.
+  void observer_points(int observers, int spread, int frame) {
+    m_observers.resize(observers);
+    for (int i = 0; i < observers; i++)
+      m_observers[i] = orbit_point(frame + i * spread / observers);
+  }
+
+  void bench_multi_view(const char *name, int observers, int spread,
+                        int depth, float k) {
+    measure({name, depth, k}, [&](int frame) {
+      observer_points(observers, spread, frame);
+      m_multi_view.update(settings(LodMode::rebuild, depth, k, frame),
+                          m_observers.data(), m_observers.size());
+      return m_multi_view.stats().observer_nodes;
+    });
+  }
+
+  // What multi_view replaces: one split() per observer, and its leaves.
+  void bench_multi_view_separate(const char *name, int observers, int spread,
+                                 int depth, float k) {
+    measure({name, depth, k}, [&](int frame) {
+      observer_points(observers, spread, frame);
+      size_t nodes = 0;
+      for (auto point : m_observers) {
+        auto s = settings(LodMode::rebuild, depth, k, frame);
+        s.point = point;
+        m_planet.update(s);
+        nodes += m_planet.stats().nodes;
+        m_observer_leaves.clear();
+        KeyCollector collector;
+        collector.keys = &m_observer_leaves;
+        for (int i = 0; i < 6; i++)
+          m_planet.visit(static_cast<Face>(i), collector);
+      }
+      return nodes;
+    });
+  }
+
+  void bench_face_projection() {
+    const int points = 4096;
+    measure({"face_projection", -1, 0}, [&](int frame) {
+      float sum = 0;
+      for (int n = 0; n < points; n++) {
+        auto point = orbit_point(frame * points + n);
+        for (int i = 0; i < 6; i++)
+          sum += face_focus_point(static_cast<Face>(i), point, 2.f).x;
+      }
+      g_sink = sum;
+      return size_t(6 * points);
+    });
+  }
+
+  int m_frames;
+  WorkStealingPool m_workers;
+  CPlanet m_planet;
+  CLinearQuadTree m_linear;
+  CTileCache m_tiles;
+  CTileJobs m_tile_jobs;
+  CMeshBuilder m_orbit_builder; // keeps its capacity across the orbit runs
+  CLodPipeline m_pipeline{m_planet, m_tiles, m_tile_jobs};
+  CMultiViewLod m_multi_view{m_workers};
+  std::vector<glm::vec2> m_observers;
+  std::vector<NodeKey> m_observer_leaves;
+  CPatchCuller::Planes m_frustum;
+  glm::vec3 m_eye;
+  std::vector<Result> m_results;
+  int m_failures = 0;
+  CacheMissCounter m_cache_misses;
+};
+} // namespace
+
+int main(int argc, char **argv) {
+  int frames = argc > 2 ? std::atoi(argv[2]) : 60;
+  Bench bench(frames > 0 ? frames : 60);
+  int failures = bench.run_checks();
+  bench.run_grid();
+
+  FILE *out = stdout;
+  if (argc > 1 && !(out = fopen(argv[1], "w"))) {
+    fprintf(stderr, "cannot open %s\n", argv[1]);
+    return 1;
+  }
+  bench.write(out);
+  if (out != stdout)
+    fclose(out);
+  return failures ? 1 : 0;
+}
@@ -16,8 +16,17 @@
 #include <gl/GL.h>
 
 #include <QuadTree.h>
+#include <Planet.h>
+#include <MeshBuilder.h>
 #include <Camera.h>
+#include <Profiler.h>
+#include <Replay.h>
+#include <TileCache.h>
+#include <TileJobs.h>
+#include <LodPipeline.h>
+#include <QualityGovernor.h>
 #include <set>
+#include <string>
 using namespace glm;
 
 CCamera gCamera;
@@ -33,127 +42,40 @@ float speed_factor = 0.1;
 float POINT_SPEED = 0.001;
 int DEPTH = 16;
 bool is_wireframe = false;
+bool batched_draw = true;
+bool frustum_cull = true;
+bool horizon_cull = true;
+bool leaf_deltas = true;
+bool tile_cache = true;
+int tile_budget_mb = 16;
+CTileCache tileCache;
+bool async_tiles = true; // batched draw only
+int tiles_per_frame = 2048;
+CTileJobs tileJobs;
+bool show_profiler = false;
+std::string trace_path = "terrain_trace.json";
+int trace_frames = 0; // stop the trace after this many frames, if positive
+std::string record_path = "terrain_replay.bin";
+CReplayWriter recorder;
+SplitPolicy split_policy = SplitPolicy::distance;
+float pixel_error = 2.f;
+LodMode lod_mode = LodMode::incremental;
+int node_budget_k = 256; // LodMode::budgeted, in thousands of nodes
+float merge_band = 0.f; // LodMode::incremental
+int min_lifetime = 0;
+WorkStealingPool lod_workers;
+CPlanet planet(lod_workers);
+CMeshBuilder meshBuilder;
+bool lod_thread = true; // batched draw only
+CLodPipeline lodPipeline(planet, tileCache, tileJobs);
+uint64_t render_frame = 0;
+uint64_t frames_behind = 0; // of the LOD frame drawn last
+LodReport lod_report; // of the LOD frame drawn last
+bool governor_on = false;
+CQualityGovernor governor; // K, DEPTH and pixel_error are its ceiling
 
 namespace
 {
-	enum class Face
-	{
-		right, //px
-		top, //py
-		back, //pz
-		left, //nx
-		botoom, //ny
-		front  //nz
-	};
-
-	struct Quad
-	{
-		vec3 p1, p2, p3, p4;
-		vec3 color;
-		Quad(vec3 p1, vec3 p2, vec3 p3, vec3 p4, vec3 color) : p1(p1), p2(p2), p3(p3), p4(p4), color(color) {}
-	};
-
-	static const float radii = 1;
-
-	vec3 get_offset(Face f, vec2 of, float size)
-	{
-		vec3 o{ 0,0,0 };
-		float& x = of.x;
-		float& y = of.y;
-		switch (f)
-		{
-		case Face::back:
-			o = { -x, y, -size };
-			break;
-		case Face::right:
-			o = { size, y, -x };
-			break;
-		case Face::left:
-			o = { -size, y, x };
-			break;
-		case Face::top:
-			o = { x, size, y };
-			break;
-		case Face::botoom:
-			o = { -x, -size, -y };
-			break;
-		case Face::front:
-			o = { x, y, size };
-			break;
-		default:
-			assert(0);
-			break;
-		}
-		return o;
-	}
-
-	Quad get_cube_face(Face f, float size, vec2 origin)
-	{
-		switch (f)
-		{
-			// White side - BACK
-		case Face::back:
-			return Quad({
-			glm::vec3(size, -size, 0),
-			glm::vec3(size, size, 0),
-			glm::vec3(-size, size, 0),
-			glm::vec3(-size, -size, 0),
-			glm::vec3(   1.0,  1.0, 1.0 )
-				});
-
-			// Purple side - RIGHT
-		case Face::right:
-			return Quad({
-				glm::vec3(0, -size, -size),
-				glm::vec3(0, size, -size),
-				glm::vec3(0, size, size),
-				glm::vec3(0, -size, size),
-				glm::vec3(  1.0,  0.0,  1.0 )
-				});
-
-			// Green side - LEFT
-		case Face::left:
-			return Quad({
-			glm::vec3(0, -size, size),
-			glm::vec3(0, size, size),
-			glm::vec3(0, size, -size),
-			glm::vec3(0, -size, -size),
-			glm::vec3(   0.0,  1.0,  0.0 )
-				});
-
-			// Blue side - TOP
-		case Face::top:
-			return Quad({
-			glm::vec3(size, 0, size),
-			glm::vec3(size, 0, -size),
-			glm::vec3(-size, 0, -size),
-			glm::vec3(-size, 0, size),
-			glm::vec3(   0.0,  0.0,  1.0 )
-				});
-
-			// Red side - BOTTOM
-		case Face::botoom:
-			return Quad({
-			glm::vec3(size, 0, -size),
-			glm::vec3(size, 0, size),
-			glm::vec3(-size, 0, size),
-			glm::vec3(-size, 0, -size),
-			glm::vec3(   1.0,  0.0,  0.0 )
-				});
-		case Face::front:
-			return Quad({
-			 glm::vec3(size, -size, 0),      // P1 is red
-			 glm::vec3(size, size, 0),      // P2 is green
-			 glm::vec3(-size, size, 0),      // P3 is blue
-			 glm::vec3(-size, -size, 0),      // P4 is 
-			 glm::vec3(   0.0,  1.0, 1.0 )
-				});
-		default:
-			assert(0);
-			break;
-		}
-	}
-
 	void render_quad(const Quad& quad)
 	{
 		glBegin(GL_QUADS);
@@ -169,6 +91,20 @@ namespace
 
 	}
 
+	// Submits all leaves of a face with a single array draw.
+	void render_mesh(const FaceMesh& mesh)
+	{
+		if (mesh.vertex_count() == 0)
+			return;
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glEnableClientState(GL_COLOR_ARRAY);
+		glVertexPointer(3, GL_FLOAT, 0, mesh.positions.data());
+		glColorPointer(3, GL_FLOAT, 0, mesh.colors.data());
+		glDrawArrays(GL_QUADS, 0, static_cast<GLsizei>(mesh.vertex_count()));
+		glDisableClientState(GL_COLOR_ARRAY);
+		glDisableClientState(GL_VERTEX_ARRAY);
+	}
+
 	void wireframe(bool mode)
 	{
 		int native = mode ? GL_LINE : GL_FILL;
@@ -196,26 +132,6 @@ namespace
 	}
 
 	
-// 0 ... 1 output range
-__forceinline glm::vec2 world_coords_to_face_space(const float x,const float y,const float z) {
-    return (glm::vec2(x/z,y/z)+1.0f)*0.5f;
-}
-
-// 0 ... 1 output range
-__forceinline glm::vec2 world_coords_to_face_space(const Face face_type, const float x,const float y,const float z) {
-    switch(face_type) // same as using coords_swizzle & unity_swizzle
-    {
-		case Face::right: return world_coords_to_face_space( y,  z,  glm::abs(x)); // px
-    case Face::top: return world_coords_to_face_space(-x,  z,  glm::abs(y)); // py
-    case Face::left: return world_coords_to_face_space(-y,  z,  glm::abs(x)); // nx
-    case Face::botoom: return world_coords_to_face_space( x,  z,  glm::abs(y)); // ny
-    case Face::back: return world_coords_to_face_space( y, -x,  glm::abs(z)); // pz
-    case Face::front: return world_coords_to_face_space( y,  x,  glm::abs(z)); // nz
-    default: break;
-    };
-    return glm::vec2(0.0);
-}
-
 }
 
 class CRender : public IQuadTreeRender {
@@ -225,26 +141,33 @@ public:
 
 	}
   void draw_plane(double ox, double oy, double size, color3 color) override {
-		auto q = get_cube_face(m_CurrentFace, 0.5 * size, vec2(ox, oy));
+		auto q = project_to_sphere(m_CurrentFace, ox, oy, size, m_CurrentRadius);
 		q.color.r = color.r;
 		q.color.g = color.g;
 		q.color.b = color.b;
 
-		vec3 origin = get_offset(m_CurrentFace, vec2(ox,oy), m_CurrentRadius);
-		q.p1 = glm::normalize(q.p1 += origin)*m_CurrentRadius;;
-		q.p2 = glm::normalize(q.p2 += origin)*m_CurrentRadius;;
-		q.p3 = glm::normalize(q.p3 += origin)*m_CurrentRadius;;
-		q.p4 = glm::normalize(q.p4 += origin)*m_CurrentRadius;;
-
 		render_quad(q);
   }
+	// draw_plane() for a leaf, with the corners from the tile cache if set.
+	void draw_node(const QuadTree& qt)
+	{
+		if (!cache)
+		{
+			draw_plane(qt.x(), qt.y(), qt.size(), qt.color());
+			return;
+		}
+		auto tile = cache->get(qt, m_CurrentRadius);
+		auto& c = qt.color();
+		render_quad(Quad(tile.corners[0], tile.corners[1], tile.corners[2], tile.corners[3], glm::vec3(c.r, c.g, c.b)));
+	}
 	Face m_CurrentFace = Face::botoom;
 	float m_CurrentRadius = 1;
+	CTileCache* cache = nullptr;
 };
 
 class TreeRender : public ITreeVisitorCallback {
 public:
-  TreeRender(IQuadTreeRender *render) : render(render) {}
+  TreeRender(CRender *render) : render(render) {}
   virtual void BeforVisit(QuadTree *qt) {
 		wireframe(is_wireframe);
 	}
@@ -252,10 +175,10 @@ public:
 		wireframe(false);
 	}
   virtual void OnLeaf(QuadTree *qt, bool is_last, int level) override {
-    render->draw_plane(qt->m_x, qt->m_y, qt->m_size, qt->m_color);
+    render->draw_node(*qt);
   }
 
-  IQuadTreeRender *render = nullptr;
+  CRender *render = nullptr;
 };
 
 /*
@@ -329,6 +252,7 @@ void update()
 
 void display()
 {
+	auto display_start = std::chrono::steady_clock::now();
 	glInit();
 	rotate_x += 0.5;
 	rotate_y += 0.5;
@@ -337,27 +261,124 @@ void display()
 	auto point = pos + glm::normalize(gCamera.Front);
 	auto up = gCamera.Up;
 
-	std::vector<QuadTree> quadTrees;
+	render_frame++;
+	// The planet, tile cache and tile jobs belong to the LOD thread while it
+	// runs.
+	bool pipelined = batched_draw && lod_thread;
+	if (pipelined)
+		lodPipeline.start();
+	else
+		lodPipeline.stop();
+
 	CRender render;
 	render.m_CurrentRadius = 0.5 * quad_size;
+	if (!pipelined)
+		tileCache.set_budget(size_t(tile_budget_mb) << 20);
+	render.cache = tile_cache ? &tileCache : nullptr;
+	meshBuilder.cache = render.cache;
+	meshBuilder.jobs = tile_cache && async_tiles ? &tileJobs : nullptr;
 	TreeRender treeRender = TreeRender(&render);
 
-	for (int i = 0; i < 6; i++)
+	// Goes through the same ReplayFrame as a recording, so that terrain_replay
+	// reproduces exactly these settings.
+	ReplayFrame frame;
+	frame.position = gCamera.getPosition();
+	frame.rotation = gCamera.getRotation();
+	frame.fov = gCamera.FOV;
+	frame.point = ::point;
+	frame.origin = quad_origin;
+	CQualityGovernor::Quality ceiling{K, DEPTH, pixel_error};
+	auto& quality = governor_on ? governor.quality() : ceiling;
+	frame.k = quality.k;
+	frame.size = quad_size;
+	frame.pixel_error = quality.pixel_error;
+	frame.depth = quality.depth;
+	frame.mode = lod_mode;
+	frame.policy = split_policy;
+	frame.frustum_cull = frustum_cull;
+	frame.horizon_cull = horizon_cull;
+	frame.node_budget = uint32_t(node_budget_k) * 1000;
+	frame.merge_band = merge_band;
+	frame.min_lifetime = min_lifetime;
+	if (recorder.is_open())
+		recorder.write(frame);
+	auto settings = replay_settings(frame, gCamera, winH);
+	settings.leaf_deltas = leaf_deltas;
+	auto lod_start = std::chrono::steady_clock::now();
+	if (pipelined)
 	{
-		auto qt = QuadTree(DEPTH, quad_size, quad_origin.x, quad_origin.y, color3(1, 1, 0));
-		auto p = 2*render.m_CurrentRadius*(world_coords_to_face_space(static_cast<Face>(i), ::point.x, 2, ::point.y) - 0.5f);
-		qt.split(p.x, p.y, K);
-		quadTrees.push_back(qt);
+		auto& input = lodPipeline.input();
+		input.settings = settings;
+		input.frame = render_frame;
+		input.simd_path = meshBuilder.simd_path;
+		input.tile_cache = tile_cache;
+		input.tile_budget = size_t(tile_budget_mb) << 20;
+		input.async_tiles = async_tiles;
+		input.tiles_per_frame = tiles_per_frame;
+		lodPipeline.submit();
 	}
+	else
+		planet.update(settings);
 
-	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	draw_grid(20, 20, 20, 20);
-	draw_axes(20);
-	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	for (int i = 0; i < 6; i++)
 	{
-		render.m_CurrentFace = static_cast<Face>(i);
-		quadTrees[i].visit(&treeRender, 0, 0, 0);
+		PROFILE_SCOPE("grid");
+		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+		draw_grid(20, 20, 20, 20);
+		draw_axes(20);
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	}
+	if (pipelined)
+	{
+		// Draws the last frame the LOD thread finished, which may be this one's
+		// or an older one, but never waits for it.
+		PROFILE_SCOPE("draw");
+		if (auto output = lodPipeline.output())
+		{
+			frames_behind = render_frame - output->frame;
+			lod_report = output->report;
+			wireframe(is_wireframe);
+			for (int i = 0; i < 6; i++)
+				render_mesh(output->builder.mesh(static_cast<Face>(i)));
+			wireframe(false);
+		}
+	}
+	else if (batched_draw)
+	{
+		{
+			PROFILE_SCOPE("emit");
+			build_planet_mesh(planet, meshBuilder, tiles_per_frame);
+		}
+		frames_behind = 0;
+		lod_report = report_lod(planet, tileCache, tileJobs);
+		lod_report.lod_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lod_start).count();
+		PROFILE_SCOPE("draw");
+		wireframe(is_wireframe);
+		for (int i = 0; i < 6; i++)
+			render_mesh(meshBuilder.mesh(static_cast<Face>(i)));
+		wireframe(false);
+	}
+	else
+	{
+		// Emission and submission are interleaved here.
+		PROFILE_SCOPE("draw");
+		VirtualTreeVisitor treeVisitor{&treeRender};
+		for (int i = 0; i < 6; i++)
+		{
+			TRACE_SCOPE("visit_face", i);
+			render.m_CurrentFace = static_cast<Face>(i);
+			planet.visit(render.m_CurrentFace, treeVisitor);
+		}
+		frames_behind = 0;
+		lod_report = report_lod(planet, tileCache, tileJobs);
+		lod_report.lod_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lod_start).count();
+	}
+	if (governor_on)
+	{
+		// The LOD thread has to keep up with the render thread, so a pipelined
+		// frame costs whichever of the two takes longer.
+		double render_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - display_start).count();
+		double cost_ms = pipelined ? std::max(render_ms, lod_report.lod_ms) : render_ms;
+		governor.update(cost_ms, ceiling, split_policy);
 	}
 #if 0
   glRotatef( rotate_y, 0.0, 1.0, 0.0 );
@@ -456,6 +477,106 @@ void Cleanup()
     SDL_Quit();
 }
 
+#if TERRAIN_PROFILER
+namespace
+{
+	// Stacked bar per recorded frame, one color per stage, with the frame's
+	// wall time as a tick above it; min/avg/p99 of every stage below.
+	void draw_profiler_window(bool* open)
+	{
+		static const ImU32 colors[] = {
+			IM_COL32(230, 25, 75, 255), IM_COL32(60, 180, 75, 255), IM_COL32(255, 225, 25, 255),
+			IM_COL32(0, 130, 200, 255), IM_COL32(245, 130, 48, 255), IM_COL32(145, 30, 180, 255),
+			IM_COL32(70, 240, 240, 255), IM_COL32(240, 50, 230, 255),
+		};
+		const int color_count = sizeof(colors) / sizeof(colors[0]);
+
+		ImGui::SetNextWindowSize(ImVec2(520, 360), ImGuiCond_FirstUseEver);
+		if (!ImGui::Begin("Profiler", open))
+		{
+			ImGui::End();
+			return;
+		}
+		auto& profiler = CProfiler::instance();
+		int stages = profiler.stage_count();
+		int frames = profiler.frame_count();
+
+		float scale_ms = 1000.f / 60;
+		for (int n = 0; n < frames; n++)
+			scale_ms = glm::max(scale_ms, profiler.frame_ms(n));
+
+		ImVec2 origin = ImGui::GetCursorScreenPos();
+		ImVec2 extent(ImGui::GetContentRegionAvail().x, 120);
+		float bar_w = extent.x / CProfiler::history;
+		auto* draw = ImGui::GetWindowDrawList();
+		draw->AddRectFilled(origin, ImVec2(origin.x + extent.x, origin.y + extent.y), IM_COL32(30, 30, 30, 255));
+		for (int n = 0; n < frames; n++)
+		{
+			float x = origin.x + (CProfiler::history - frames + n) * bar_w;
+			float y = origin.y + extent.y;
+			for (int s = 0; s < stages; s++)
+			{
+				float h = extent.y * profiler.stage_ms(n, s) / scale_ms;
+				draw->AddRectFilled(ImVec2(x, y - h), ImVec2(x + bar_w, y), colors[s % color_count]);
+				y -= h;
+			}
+			float frame_y = origin.y + extent.y * (1 - profiler.frame_ms(n) / scale_ms);
+			draw->AddLine(ImVec2(x, frame_y), ImVec2(x + bar_w, frame_y), IM_COL32(255, 255, 255, 255));
+		}
+		ImGui::Dummy(extent);
+		ImGui::Text("scale %.1f ms", scale_ms);
+
+		auto frame = profiler.frame_stats();
+		ImGui::Text("%-8s min %6.2f  avg %6.2f  p99 %6.2f ms", "frame", frame.min, frame.avg, frame.p99);
+		for (int s = 0; s < stages; s++)
+		{
+			auto stats = profiler.stats(s);
+			ImVec2 swatch = ImGui::GetCursorScreenPos();
+			draw->AddRectFilled(swatch, ImVec2(swatch.x + 10, swatch.y + 10), colors[s % color_count]);
+			ImGui::Dummy(ImVec2(10, 10));
+			ImGui::SameLine();
+			ImGui::Text("%-8s min %6.2f  avg %6.2f  p99 %6.2f ms", profiler.stage_name(s).c_str(), stats.min, stats.avg, stats.p99);
+		}
+		ImGui::End();
+	}
+}
+#endif
+
+// F2 or --trace <file> [--trace-frames <n>]
+void toggle_trace()
+{
+#if TERRAIN_PROFILER
+	// The LOD thread records into the trace buffer that start() and stop()
+	// replace, so it must not run meanwhile.
+	bool lod_running = lodPipeline.running();
+	lodPipeline.stop();
+	auto& trace = CTraceRecorder::instance();
+	if (trace.recording())
+	{
+		printf("trace: %zu events (%zu dropped) written to %s\n", trace.events(), trace.dropped(), trace.path().c_str());
+		trace.stop();
+	}
+	else
+		trace.start(trace_path);
+	if (lod_running)
+		lodPipeline.start();
+#else
+	printf("trace: tracing is compiled out, build with TERRAIN_PROFILER\n");
+#endif
+}
+
+// F3 or --record <file>
+void toggle_recording()
+{
+	if (recorder.is_open())
+	{
+		printf("recording: %zu frames written to %s\n", recorder.frames(), recorder.path().c_str());
+		recorder.close();
+	}
+	else if (!recorder.open(record_path))
+		printf("cannot open %s\n", record_path.c_str());
+}
+
 bool ProcessEvents(std::set<int> &keycodes)
 {
 	bool done = false;
@@ -470,6 +591,10 @@ bool ProcessEvents(std::set<int> &keycodes)
 				case SDL_KEYDOWN:
 				{
 					keycodes.insert(event.key.keysym.scancode);
+					if (event.key.keysym.scancode == SDL_SCANCODE_F2 && !event.key.repeat)
+						toggle_trace();
+					if (event.key.keysym.scancode == SDL_SCANCODE_F3 && !event.key.repeat)
+						toggle_recording();
 					break;
 				}
 				case SDL_KEYUP:
@@ -528,8 +653,25 @@ bool ProcessEvents(std::set<int> &keycodes)
 		return done;
 }
 // Main code
-int main(int, char**)
+int main(int argc, char** argv)
 {
+	bool trace_at_start = false;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--trace" && i + 1 < argc)
+		{
+			trace_path = argv[++i];
+			trace_at_start = true;
+		}
+		else if (arg == "--trace-frames" && i + 1 < argc)
+			trace_frames = atoi(argv[++i]);
+		else if (arg == "--record" && i + 1 < argc)
+		{
+			record_path = argv[++i];
+			toggle_recording();
+		}
+	}
 	if (Init())
 	{
     // Our state
@@ -540,6 +682,11 @@ int main(int, char**)
     // Main loop
 		std::set<int> keycodes;
     bool done = false;
+		if (trace_at_start)
+			toggle_trace();
+#if TERRAIN_PROFILER
+		int traced_frames = 0;
+#endif
     while (!done)
     {
         // Poll and handle events (inputs, window resize, etc.)
@@ -548,11 +695,15 @@ int main(int, char**)
         // - When io.WantCaptureKeyboard is true, do not dispatch keyboard input data to your main application.
         // Generally you may always pass all inputs to dear imgui, and hide them from your application based on those two flags.
 
-			done = ProcessEvents(keycodes);
+			{
+				PROFILE_SCOPE("events");
+				done = ProcessEvents(keycodes);
+			}
 
         // Start the Dear ImGui frame
         ImGui_ImplOpenGL2_NewFrame();
         ImGui_ImplSDL2_NewFrame(window);
+        PROFILE_BEGIN(ui, "imgui");
         ImGui::NewFrame();
 
         // 1. Show the big demo window (Most of the sample code is in ImGui::ShowDemoWindow()! You can browse its code to learn more about Dear ImGui!).
@@ -580,6 +731,96 @@ int main(int, char**)
 						ImGui::SliderFloat("FOV", &gCamera.FOV, 30.f, 150.f);
 						ImGui::SliderFloat("point speed", &POINT_SPEED, 0.001f, 0.01f);
 						ImGui::SliderFloat2("point", &point[0], 0.f, 1.f);
+						ImGui::Combo("LOD mode", (int*)&lod_mode, "Rebuild\0Incremental\0Parallel rebuild\0Breadth-first rebuild\0Implicit (no tree)\0Budgeted rebuild\0");
+						if (lod_mode == LodMode::budgeted)
+							ImGui::SliderInt("Node budget (k)", &node_budget_k, 1, 8192);
+						ImGui::Combo("Split criterion", (int*)&split_policy, "Distance\0Screen-space error\0");
+						if (split_policy == SplitPolicy::screen_space)
+							ImGui::SliderFloat("Pixel error", &pixel_error, 0.25f, 16.f);
+						if (ImGui::Checkbox("Quality governor", &governor_on) && governor_on)
+							governor.reset({K, DEPTH, pixel_error});
+						if (governor_on)
+						{
+							ImGui::SliderFloat("Target frame (ms)", &governor.target_ms, 2.f, 50.f);
+							auto& quality = governor.quality();
+							ImGui::Text("%s, %.2f ms%s%s", CQualityGovernor::state_name(governor.state()), governor.smoothed_ms(),
+								governor.at_floor() ? ", at floor" : "", governor.at_ceiling() ? ", at sliders" : "");
+							if (split_policy == SplitPolicy::screen_space)
+								ImGui::Text("effective depth %d, pixel error %.2f", quality.depth, quality.pixel_error);
+							else
+								ImGui::Text("effective depth %d, split factor %.2f", quality.depth, quality.k);
+						}
+						if (lod_mode == LodMode::implicit)
+							ImGui::Text("no tree, leaves are enumerated while drawing");
+						else if (lod_mode == LodMode::budgeted)
+						{
+							auto& stats = lod_report.planet;
+							ImGui::Text("%zu of %zu nodes granted", stats.nodes, size_t(node_budget_k) * 1000);
+							if (stats.denied)
+								ImGui::Text("%zu requested at least, %zu splits denied", stats.nodes + 4 * stats.denied, stats.denied);
+						}
+						else
+							ImGui::Text("%zu nodes", lod_report.planet.nodes);
+						ImGui::Checkbox("Frustum culling", &frustum_cull);
+						ImGui::SameLine();
+						ImGui::Checkbox("Horizon culling", &horizon_cull);
+						if ((frustum_cull || horizon_cull) && lod_mode != LodMode::implicit)
+							ImGui::Text("%zu leaves visible, %zu subtrees culled", lod_report.planet.visible, lod_report.planet.culled);
+						ImGui::Checkbox("Leaf deltas", &leaf_deltas);
+						if (leaf_deltas)
+						{
+							ImGui::SameLine();
+							ImGui::Text("+%zu -%zu leaves", lod_report.planet.added, lod_report.planet.removed);
+						}
+						ImGui::Checkbox("Tile cache", &tile_cache);
+						if (tile_cache)
+						{
+							ImGui::SliderInt("Tile budget (MB)", &tile_budget_mb, 1, 256);
+							auto& tiles = lod_report.tiles;
+							ImGui::Text("%zu tiles, %.1f MB", lod_report.tile_count, lod_report.tile_bytes / double(1 << 20));
+							ImGui::Text("%zu hits, %zu misses, %zu evictions", tiles.hits, tiles.misses, tiles.evictions);
+							if (batched_draw)
+							{
+								ImGui::Checkbox("Async tiles", &async_tiles);
+								if (async_tiles)
+								{
+									ImGui::SliderInt("Tiles per frame", &tiles_per_frame, 64, 16384);
+									auto& jobs = lod_report.jobs;
+									ImGui::Text("%zu queued, %zu ready", jobs.queued, jobs.ready);
+									if (jobs.completed)
+										ImGui::Text("%zu in, latency %.1f ms mean, %.1f ms max", jobs.completed, jobs.latency_ms, jobs.max_latency_ms);
+								}
+							}
+						}
+						ImGui::Checkbox("Batched draw", &batched_draw);
+						if (batched_draw)
+						{
+							static int simd_path = static_cast<int>(best_simd_path());
+							ImGui::Combo("Projection", &simd_path, "scalar\0sse\0avx2\0");
+							if (!simd_path_supported(static_cast<SimdPath>(simd_path)))
+								simd_path = static_cast<int>(best_simd_path());
+							meshBuilder.simd_path = static_cast<SimdPath>(simd_path);
+							ImGui::Checkbox("LOD thread", &lod_thread);
+							if (lod_thread)
+							{
+								ImGui::SameLine();
+								ImGui::Text("%llu frames behind", (unsigned long long)frames_behind);
+							}
+						}
+						ImGui::Text("LOD %.2f ms", lod_report.lod_ms);
+						if (lod_mode == LodMode::incremental)
+						{
+							ImGui::SliderFloat("Merge band", &merge_band, 0.f, 1.f);
+							ImGui::SliderInt("Min lifetime (frames)", &min_lifetime, 0, 120);
+							ImGui::Text("%zu nodes changed, %zu flipped", lod_report.planet.changed, lod_report.planet.flips);
+						}
+						if (lod_mode == LodMode::parallel)
+						{
+							auto utilization = lod_workers.utilization();
+							for (size_t i = 0; i < utilization.size(); i++)
+								ImGui::Text("thread %zu: %.0f%% busy", i, 100 * utilization[i]);
+							lod_workers.reset_stats();
+						}
             ImGui::ColorEdit3("clear color", (float*)&clear_color); // Edit 3 floats representing a color
 
             if (ImGui::Button("Button"))                            // Buttons return true when clicked (most widgets return true when edited/activated)
@@ -588,6 +829,9 @@ int main(int, char**)
             ImGui::Text("counter = %d", counter);
 
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+#if TERRAIN_PROFILER
+            ImGui::Checkbox("Profiler", &show_profiler);
+#endif
             ImGui::End();
         }
 
@@ -600,7 +844,15 @@ int main(int, char**)
                 show_another_window = false;
             ImGui::End();
         }
-				update();
+#if TERRAIN_PROFILER
+        if (show_profiler)
+            draw_profiler_window(&show_profiler);
+#endif
+        PROFILE_END(ui);
+				{
+					PROFILE_SCOPE("update");
+					update();
+				}
 
 				//gluLookAt(-5, 15, -10, 0, 0, 0, 0, 1, 0);
 
@@ -609,16 +861,38 @@ int main(int, char**)
 
 
         // Rendering
+        PROFILE_BEGIN(ui_render, "imgui");
         ImGui::Render();
+        PROFILE_END(ui_render);
         glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
         glClearColor(clear_color.x, clear_color.y, clear_color.z, clear_color.w);
         glClear(GL_COLOR_BUFFER_BIT);
 				display();
 
         //glUseProgram(0); // You may want this if using this code in an OpenGL 3+ context where shaders may be bound
-        ImGui_ImplOpenGL2_RenderDrawData(ImGui::GetDrawData());
-        SDL_GL_SwapWindow(window);
+        {
+            PROFILE_SCOPE("imgui");
+            ImGui_ImplOpenGL2_RenderDrawData(ImGui::GetDrawData());
+        }
+        {
+            PROFILE_SCOPE("swap");
+            SDL_GL_SwapWindow(window);
+        }
+        PROFILE_END_FRAME();
+#if TERRAIN_PROFILER
+        auto& trace = CTraceRecorder::instance();
+        if (trace.recording() && trace_frames > 0 && ++traced_frames == trace_frames)
+            toggle_trace();
+        if (!trace.recording())
+            traced_frames = 0;
+#endif
     }
+#if TERRAIN_PROFILER
+		if (CTraceRecorder::instance().recording())
+			toggle_trace();
+#endif
+		if (recorder.is_open())
+			toggle_recording();
 		Cleanup();
 
 	}
@@ -0,0 +1,86 @@
+// Headless replay of a session recorded by the viewer (F3 or --record).
+// Every recorded frame is run through the LOD update and the mesh build as
+// fast as possible, one step per frame, and the per-frame CPU time
+// percentiles are reported.
+//
+// usage: terrain_replay <recording> [repeats] [viewport height]
+
+#include "MeshBuilder.h"
+#include "Replay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+using replay_clock = std::chrono::steady_clock;
+
+double ms_since(replay_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(replay_clock::now() - start)
+      .count();
+}
+
+void report(const char *name, std::vector<double> samples) {
+  if (samples.empty())
+    return;
+  std::sort(samples.begin(), samples.end());
+  auto at = [&](double q) {
+    return samples[std::min(samples.size() - 1, size_t(q * samples.size()))];
+  };
+  printf("%-6s p50 %8.3f  p95 %8.3f  p99 %8.3f  max %8.3f ms\n", name,
+         at(0.50), at(0.95), at(0.99), samples.back());
+}
+} // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <recording> [repeats] [viewport height]\n",
+            argv[0]);
+    return 1;
+  }
+  std::vector<ReplayFrame> frames;
+  if (!read_replay(argv[1], frames)) {
+    fprintf(stderr, "cannot read %s\n", argv[1]);
+    return 1;
+  }
+  int repeats = argc > 2 ? std::max(1, std::atoi(argv[2])) : 1;
+  int viewport_height = argc > 3 ? std::atoi(argv[3]) : 720;
+
+  WorkStealingPool workers;
+  CPlanet planet(workers);
+  CCamera camera;
+  CMeshBuilder builder;
+  MeshEmitter emitter(&builder);
+
+  std::vector<double> lod, mesh, total;
+  size_t leaves = 0;
+  for (int repeat = 0; repeat < repeats; repeat++) {
+    for (auto &frame : frames) {
+      auto start = replay_clock::now();
+      planet.update(replay_settings(frame, camera, viewport_height));
+      double lod_ms = ms_since(start);
+
+      auto mesh_start = replay_clock::now();
+      builder.begin(planet.radius());
+      for (int i = 0; i < 6; i++) {
+        builder.set_face(static_cast<Face>(i));
+        planet.visit(static_cast<Face>(i), emitter);
+      }
+      builder.end();
+      mesh.push_back(ms_since(mesh_start));
+      lod.push_back(lod_ms);
+      total.push_back(ms_since(start));
+      leaves += builder.vertex_count() / 4;
+    }
+  }
+
+  printf("%zu frames x %d, %u threads, %.1f leaves per frame\n", frames.size(),
+         repeats, workers.size(),
+         total.empty() ? 0.0 : double(leaves) / total.size());
+  report("lod", lod);
+  report("mesh", mesh);
+  report("total", total);
+  return 0;
+}